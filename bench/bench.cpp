@@ -0,0 +1,498 @@
+// Throughput benchmarks for the emulator. Build them in release mode:
+//
+//   cmake -S . -B build -DCMAKE_BUILD_TYPE=Release -DCHIP8_BENCH=ON
+//   cmake --build build --target chip8_bench
+//   build/bench/chip8_bench [name...]
+//
+// With no names every benchmark runs. Timings are the median of several
+// repetitions.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "chip8.hpp"
+#include "libretro.h"
+
+namespace {
+
+constexpr int repetitions = 5;
+
+volatile int sink;
+
+// Arithmetic, skips, I updates and a subroutine call in a tight loop, with
+// no drawing. Every instruction goes through the ALU or the branch paths.
+const uint8_t alu_rom[] = {
+    0x60, 0x00, // 200: V0 = 0
+    0x61, 0x01, // 202: V1 = 1
+    0x62, 0x03, // 204: V2 = 3
+    0xA3, 0x00, // 206: I = 300
+    0x80, 0x14, // 208: V0 += V1
+    0x81, 0x25, // 20A: V1 -= V2
+    0x82, 0x06, // 20C: V2 >>= 1
+    0x72, 0x01, // 20E: V2 += 1
+    0x30, 0x05, // 210: skip if V0 == 5
+    0x83, 0x13, // 212: V3 ^= V1
+    0x64, 0x00, // 214: V4 = 0
+    0x84, 0x42, // 216: V4 &= V4
+    0x43, 0x07, // 218: skip if V3 != 7
+    0x73, 0x01, // 21A: V3 += 1
+    0x50, 0x10, // 21C: skip if V0 == V1
+    0x80, 0x17, // 21E: V0 = V1 - V0
+    0x80, 0x0E, // 220: V0 <<= 1
+    0xF0, 0x1E, // 222: I += V0
+    0x83, 0x11, // 224: V3 |= V1
+    0x91, 0x20, // 226: skip if V1 != V2
+    0x22, 0x40, // 228: call 240
+    0x12, 0x08, // 22A: jump 208
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x75, 0x01, // 240: V5 += 1
+    0x00, 0xEE, // 242: return
+};
+
+// Draws a row of sprites and starts over, made of the sequences the
+// predecoded engine fuses: 6xkk pairs, Annn Dxyn and 7xkk 3xkk 1nnn.
+const uint8_t draw_rom[] = {
+    0x60, 0x00, // 200: V0 = 0
+    0x61, 0x00, // 202: V1 = 0
+    0xA2, 0x20, // 204: I = 220
+    0xD0, 0x15, // 206: draw 5 rows at V0, V1
+    0x70, 0x08, // 208: V0 += 8
+    0x30, 0x40, // 20A: skip if V0 == 40
+    0x12, 0x04, // 20C: jump 204
+    0x60, 0x00, // 20E: V0 = 0
+    0x61, 0x00, // 210: V1 = 0
+    0x12, 0x04, // 212: jump 204
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 220: sprite
+};
+
+struct workload {
+    const char* name;
+    const uint8_t* rom;
+    size_t size;
+};
+
+const workload workloads[] = {
+    { "alu", alu_rom, sizeof(alu_rom) },
+    { "draw", draw_rom, sizeof(draw_rom) },
+};
+
+// Median wall time of `repetitions` calls to `body`, in seconds.
+template<typename Body>
+double median_seconds(Body&& body)
+{
+    std::vector<double> times;
+    for (int i = 0; i < repetitions; ++i)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// Runs at least `instructions` instructions in slices of one 60 Hz frame's
+// worth at the fastest speed setting, ticking the timers between slices.
+// Returns how many ran.
+template<typename Cpu>
+size_t run_frames(Cpu& cpu, chip8::engine mode, size_t instructions, size_t slice = 2000)
+{
+    size_t done = 0;
+    while (done < instructions)
+    {
+        done += cpu.run(slice, mode);
+        cpu.update_timers();
+    }
+    return done;
+}
+
+void bench_fusion()
+{
+    constexpr size_t instructions = 10000000;
+    for (const auto& work : workloads)
+    {
+        chip8::cpu<> cpu;
+        cpu.load(work.rom, work.size);
+        const size_t executed = run_frames(cpu, chip8::engine::cached, instructions);
+
+        const size_t dispatches = cpu.dispatches();
+        printf("fusion %-5s %zu instructions in %zu dispatches (%.1f%% fewer)\n", work.name, executed,
+            dispatches, 100.0 * static_cast<double>(executed - dispatches) / static_cast<double>(executed));
+    }
+}
+
+void bench_engines()
+{
+    struct engine_info {
+        const char* name;
+        chip8::engine mode;
+    };
+    const engine_info engines[] = {
+        { "switch", chip8::engine::switch_case },
+        { "table", chip8::engine::table },
+        { "threaded", chip8::engine::threaded },
+        { "cached", chip8::engine::cached },
+    };
+
+    constexpr size_t instructions = 20000000;
+    for (const auto& work : workloads)
+    {
+        for (const auto& engine : engines)
+        {
+            size_t executed = 0;
+            const double seconds = median_seconds([&] {
+                chip8::cpu<> cpu;
+                cpu.load(work.rom, work.size);
+                executed = run_frames(cpu, engine.mode, instructions);
+            });
+            printf("engines %-5s %-8s %7.1f Minstr/s\n", work.name, engine.name, executed / seconds / 1e6);
+        }
+    }
+    if (!CHIP8_HAS_THREADED_DISPATCH)
+        printf("engines: threaded falls back to switch in this build\n");
+}
+
+// Build once with and once without -DCHIP8_SPECIALIZED_OPERANDS=ON to
+// compare; both variants cannot coexist in one binary.
+void bench_operands()
+{
+    const char* variant = CHIP8_HAS_SPECIALIZED_OPERANDS ? "specialised" : "generic";
+    constexpr size_t instructions = 20000000;
+    for (const auto& work : workloads)
+    {
+        size_t executed = 0;
+        const double seconds = median_seconds([&] {
+            chip8::cpu<> cpu;
+            cpu.load(work.rom, work.size);
+            executed = run_frames(cpu, chip8::engine::table, instructions);
+        });
+        printf("operands %-5s %-11s %7.1f Minstr/s\n", work.name, variant, executed / seconds / 1e6);
+    }
+}
+
+// Counts L1 data cache read misses in this thread while it is alive, where
+// the kernel exposes hardware counters. available() is false elsewhere,
+// including most virtual machines.
+class l1d_misses {
+public:
+    l1d_misses() {
+#if defined(__linux__)
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (available()) {
+            ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    ~l1d_misses() {
+#if defined(__linux__)
+        if (available())
+            close(_fd);
+#endif
+    }
+
+    l1d_misses(const l1d_misses&) = delete;
+    l1d_misses& operator=(const l1d_misses&) = delete;
+
+    bool available() const { return _fd >= 0; }
+
+    uint64_t count() const {
+        uint64_t value = 0;
+#if defined(__linux__)
+        if (available() && read(_fd, &value, sizeof(value)) != sizeof(value))
+            value = 0;
+#endif
+        return value;
+    }
+
+private:
+    int _fd = -1;
+};
+
+// Many cpus run round-robin in 10-instruction slices, one default frame
+// each, as a multi-instance host would. Once the instances outgrow the
+// caches, throughput depends on how few lines each slice touches.
+void bench_instances()
+{
+    constexpr size_t instructions = 20000000;
+    constexpr size_t slice = 10;
+    for (const size_t count : { 1, 16, 64, 256, 1024 })
+    {
+        std::vector<std::unique_ptr<chip8::cpu<>>> cpus;
+        for (size_t i = 0; i < count; ++i)
+        {
+            cpus.emplace_back(new chip8::cpu<>);
+            cpus.back()->load(alu_rom, sizeof(alu_rom));
+        }
+
+        uint64_t misses = 0;
+        bool counted = false;
+        size_t executed = 0;
+        const double seconds = median_seconds([&] {
+            l1d_misses counter;
+            executed = 0;
+            while (executed < instructions)
+            {
+                for (auto& cpu : cpus)
+                    executed += cpu->run(slice, chip8::fastest_engine);
+            }
+            misses = counter.count();
+            counted = counter.available();
+        });
+
+        char per_instruction[32] = "n/a";
+        if (counted)
+            snprintf(per_instruction, sizeof(per_instruction), "%.3f", static_cast<double>(misses) / executed);
+        printf("instances %-4zu %7.1f Minstr/s, L1D misses/instr %s\n", count, executed / seconds / 1e6,
+            per_instruction);
+    }
+}
+
+// audio::render() stereo samples per second for each synthesis quality. The
+// square pattern has 2 edges per 128 bits, the alternating one 128, and
+// the top pitch plays the pattern about 4.4x as fast as the default.
+void bench_audio()
+{
+    using audio_t = chip8::audio<>;
+    using pattern_t = chip8::cpu<>::pattern_t;
+
+    pattern_t square{};
+    square.fill(0xFF);
+    std::fill(square.begin() + square.size() / 2, square.end(), 0x00);
+    pattern_t alternating{};
+    alternating.fill(0xAA);
+
+    struct quality_info {
+        const char* name;
+        audio_t::quality value;
+    };
+    const quality_info qualities[] = {
+        { "naive", audio_t::quality::naive },
+        { "band-limited", audio_t::quality::band_limited },
+    };
+
+    constexpr int frames = 20000;
+    for (const auto& pattern : { std::make_pair("square", square), std::make_pair("alternating", alternating) })
+    {
+        for (const uint8_t pitch : { chip8::cpu<>::default_pitch, uint8_t{ 255 } })
+        {
+            for (const auto& quality : qualities)
+            {
+                audio_t audio;
+                audio.set_quality(quality.value);
+                size_t rendered = 0;
+                const double seconds = median_seconds([&] {
+                    rendered = 0;
+                    for (int i = 0; i < frames; ++i)
+                    {
+                        const size_t count = audio.render(true, pattern.second, pitch);
+                        // Read the frame back so the synthesis cannot be dropped.
+                        int sum = 0;
+                        for (size_t j = 0; j < count * audio_t::num_channels; ++j)
+                            sum += audio.data()[j];
+                        sink = sum;
+                        rendered += count;
+                    }
+                });
+                printf("audio %-11s pitch=%-3u %-12s %7.1f Msamples/s\n", pattern.first, pitch, quality.name,
+                    rendered / seconds / 1e6);
+            }
+        }
+    }
+}
+
+// video::compose() at the full 128x64 from two half-lit planes, then whole
+// frames of 1000 and 2000 draw-heavy instructions each followed by a
+// compose, against the 16.7 ms a 60 Hz frame allows.
+void bench_compose()
+{
+    using video_t = chip8::video<128, 64>;
+    using plane_t = chip8::cpu<chip8::quirks::xo_chip>::vram_t;
+
+    plane_t plane0;
+    plane_t plane1;
+    uint32_t random = 0x9E3779B9;
+    for (size_t y = 0; y < video_t::height; ++y)
+    {
+        for (size_t x = 0; x < video_t::width; x += 16)
+        {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            plane0.draw(x, y, static_cast<uint16_t>(random), 16, video_t::width, true);
+            plane1.draw(x, y, static_cast<uint16_t>(random >> 16), 16, video_t::width, true);
+        }
+    }
+    const video_t::palette_t palette{ 0xFF000000, 0xFFFFFFFF, 0xFF808080, 0xFF404040 };
+
+    constexpr int composes = 20000;
+    auto video = std::make_unique<video_t>();
+    const double seconds = median_seconds([&] {
+        for (int i = 0; i < composes; ++i)
+        {
+            video->compose(plane0, plane1, video_t::width, video_t::height, palette);
+            sink = static_cast<int>(video->framebuffer()[i % video_t::size]);
+        }
+    });
+    printf("compose 128x64 %s %7.0f ns/frame\n", CHIP8_HAS_SSE2 ? "sse2  " : "scalar", seconds / composes * 1e9);
+
+    constexpr int frames = 2000;
+    for (const size_t cycles : { 1000, 2000 })
+    {
+        chip8::cpu<> cpu;
+        cpu.load(draw_rom, sizeof(draw_rom));
+        const double frame_seconds = median_seconds([&] {
+            for (int i = 0; i < frames; ++i)
+            {
+                cpu.run(cycles, chip8::fastest_engine);
+                cpu.update_timers();
+                video->compose(cpu.vram(0), cpu.vram(1), video_t::width, video_t::height, palette);
+            }
+        }) / frames;
+        printf("compose frame cycles=%-4zu %7.1f us/frame (%.2f%% of 16.7 ms)\n", cycles, frame_seconds * 1e6,
+            100.0 * frame_seconds * 60.0);
+    }
+}
+
+// A frontend with free callbacks that discards audio and video, so only
+// emulation and input polling are timed. Variables are looked up in
+// `variables`.
+struct variable {
+    const char* key;
+    const char* value;
+};
+
+variable variables[] = {
+    { "chip8_cycles_per_frame", "10" },
+    { "chip8_input_slices", "1" },
+};
+
+unsigned polls = 0;
+
+bool environment(unsigned cmd, void* data)
+{
+    switch (cmd)
+    {
+    case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+        return true;
+    case RETRO_ENVIRONMENT_GET_INPUT_BITMASKS:
+        return true;
+    case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+        *static_cast<int*>(data) = 0;
+        return true;
+    case RETRO_ENVIRONMENT_GET_VARIABLE: {
+        auto* var = static_cast<retro_variable*>(data);
+        for (const auto& entry : variables)
+        {
+            if (strcmp(var->key, entry.key) == 0)
+            {
+                var->value = entry.value;
+                return true;
+            }
+        }
+        return false;
+    }
+    default:
+        return false;
+    }
+}
+
+void video_refresh(const void*, unsigned, unsigned, size_t) {}
+void audio_sample(int16_t, int16_t) {}
+size_t audio_sample_batch(const int16_t*, size_t frames) { return frames; }
+void input_poll() { ++polls; }
+int16_t input_state(unsigned, unsigned, unsigned, unsigned) { return 0; }
+
+// Whole retro_run() frames with the frame's cycles split into 1-8 input
+// slices, at the default speed and at the fastest speed setting.
+void bench_input()
+{
+    retro_set_environment(environment);
+    retro_set_video_refresh(video_refresh);
+    retro_set_audio_sample(audio_sample);
+    retro_set_audio_sample_batch(audio_sample_batch);
+    retro_set_input_poll(input_poll);
+    retro_set_input_state(input_state);
+    retro_init();
+
+    constexpr int frames = 100000;
+    for (const char* cycles : { "10", "1000" })
+    {
+        double single = 0;
+        for (const char* slices : { "1", "2", "4", "8" })
+        {
+            variables[0].value = cycles;
+            variables[1].value = slices;
+            polls = 0;
+            const double seconds = median_seconds([&] {
+                retro_game_info info{ "bench.ch8", alu_rom, sizeof(alu_rom), nullptr };
+                retro_load_game(&info);
+                for (int i = 0; i < frames; ++i)
+                    retro_run();
+                retro_unload_game();
+            });
+
+            const double nsec = seconds / frames * 1e9;
+            if (single == 0)
+                single = nsec;
+            printf("input cycles=%-4s slices=%s %7.0f ns/frame (%+5.0f ns), %u polls/frame\n", cycles, slices, nsec,
+                nsec - single, polls / (frames * repetitions));
+        }
+    }
+
+    retro_deinit();
+}
+
+struct benchmark {
+    const char* name;
+    void (*run)();
+};
+
+const benchmark benchmarks[] = {
+    { "fusion", bench_fusion },
+    { "engines", bench_engines },
+    { "operands", bench_operands },
+    { "input", bench_input },
+    { "audio", bench_audio },
+    { "instances", bench_instances },
+    { "compose", bench_compose },
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    for (const auto& bench : benchmarks)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i)
+            selected = selected || strcmp(argv[i], bench.name) == 0;
+        if (selected)
+            bench.run();
+    }
+    return 0;
+}
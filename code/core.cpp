@@ -4,6 +4,15 @@
 #include <stdarg.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#if defined(CHIP8_AOT)
+#include <dlfcn.h>
+#endif
 
 #include "libretro.h"
 #include "chip8.hpp"
@@ -12,17 +21,250 @@ namespace {
 
 class emu {
 public:
-    using cpu = chip8::cpu;
-    using video = chip8::video<>;
+    using machine = std::variant<
+        chip8::cpu<chip8::quirks::cosmac_vip>,
+        chip8::cpu<chip8::quirks::schip>,
+        chip8::cpu<chip8::quirks::xo_chip>>;
+    using video = chip8::video<128, 64>;
+    using audio = chip8::audio<48000, 60>;
+
+    using variant = chip8::variant;
 
     static constexpr double fps = 60.f;
-    static constexpr double sample_rate = 0.f;
+    static constexpr double sample_rate = audio::sample_rate;
+    static constexpr size_t default_cycles_per_frame = 10;
+    static constexpr uint64_t timer_rate = 60;
+    static constexpr uint64_t usec_per_second = 1000000;
+    static constexpr retro_usec_t frame_usec = usec_per_second / timer_rate;
+    static constexpr retro_usec_t max_frame_usec = frame_usec * 2;
+    static constexpr unsigned max_fastforward_present_interval = 8;
+    static constexpr unsigned max_auto_frameskip = 3;
+    static constexpr unsigned base_width = 64;
+    static constexpr unsigned base_height = 32;
+    static constexpr video::palette_t palette{ 0x000000, 0xffffff, 0xaaaaaa, 0x555555 };
 
     auto framebuffer() { return _video.framebuffer(); }
+    auto audio_buffer() const { return _audio.data(); }
+
+    template<typename Visitor>
+    decltype(auto) visit(Visitor&& visitor) { return std::visit(std::forward<Visitor>(visitor), _cpu); }
+
+    // Bump state_version whenever cpu::visit_state() or the fields below change.
+    static constexpr uint32_t state_magic = 0x54533843; // "C8ST"
+    static constexpr uint32_t state_version = 2;
+    static constexpr size_t state_size = 3 * sizeof(uint32_t) + sizeof(machine) + 3 * sizeof(uint64_t);
+
+    void load(variant type, const uint8_t* data, size_t size) {
+        _type = type;
+        _rom.assign(data, data + (data ? size : 0));
+        reset();
+    }
+
+    void set_cycles_per_frame(size_t cycles) { _cycles_per_frame = cycles; }
+    void set_engine(chip8::engine engine) { _engine = engine; }
+    void set_fastforward(bool enabled) { _fastforward = enabled; }
+    void set_audio_quality(audio::quality quality) { _audio.set_quality(quality); }
+
+    void set_idle_skip(bool enabled) {
+        _idle_skip = enabled;
+        visit([&](auto& cpu) { cpu.set_idle_skip(enabled); });
+    }
+
+    uint64_t rom_hash() const { return chip8::detail::xxh64(_rom.data(), _rom.size()); }
+
+    // Takes effect on the next reset. Without a seed, Cxkk is seeded from
+    // the ROM so every run of the same content plays out the same way.
+    void set_random_seed(bool from_content, uint64_t seed) {
+        _seed_from_content = from_content;
+        _seed = seed;
+    }
+
+    // Accepts translated code only if it was built for this exact ROM and
+    // CPU type; `nullptr` goes back to pure interpretation.
+    bool set_translation(const chip8::aot::plugin* plugin) {
+        _translation = nullptr;
+        if (plugin) {
+            const bool fits = plugin->abi_version == chip8::aot::abi_version && plugin->rom_hash == rom_hash() &&
+                visit([&](auto& cpu) {
+                    using cpu_t = std::decay_t<decltype(cpu)>;
+                    return strcmp(plugin->quirks, cpu_t::quirks_t::name) == 0 && plugin->cpu_size == sizeof(cpu_t) &&
+                        plugin->layout == cpu_t::layout_fingerprint();
+                });
+            if (!fits)
+                return false;
+            _translation = plugin->run;
+        }
+        visit([&](auto& cpu) { cpu.set_translation(_translation); });
+        return true;
+    }
+
+    void reset() {
+        emplace(_type);
+        visit([&](auto& cpu) {
+            cpu.load(_rom.data(), _rom.size());
+            cpu.set_idle_skip(_idle_skip);
+            cpu.set_translation(_translation);
+            cpu.seed(_seed_from_content ? rom_hash() : _seed);
+        });
+        _audio.reset();
+        _cycle_clock = 0;
+        _timer_clock = 0;
+        _sample_clock = 0;
+    }
+
+    bool serialize(uint8_t* data, size_t size) {
+        if (size < state_size)
+            return false;
+
+        const auto type = static_cast<uint32_t>(_type);
+        data = write(data, &state_magic, sizeof(state_magic));
+        data = write(data, &state_version, sizeof(state_version));
+        data = write(data, &type, sizeof(type));
+        data = visit([&](auto& cpu) { return write(data, [&](uint8_t* out) { cpu.serialize(out); }); });
+        data = write(data, &_cycle_clock, sizeof(_cycle_clock));
+        data = write(data, &_timer_clock, sizeof(_timer_clock));
+        write(data, &_sample_clock, sizeof(_sample_clock));
+        return true;
+    }
+
+    bool unserialize(const uint8_t* data, size_t size) {
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        uint32_t type = 0;
+        if (size < state_size)
+            return false;
+
+        data = read(data, &magic, sizeof(magic));
+        data = read(data, &version, sizeof(version));
+        data = read(data, &type, sizeof(type));
+        if (magic != state_magic || version != state_version || type != static_cast<uint32_t>(_type))
+            return false;
+
+        bool restored = false;
+        data = visit([&](auto& cpu) { return read(data, [&](const uint8_t* in) { restored = cpu.unserialize(in); }); });
+        if (!restored)
+            return false;
+        data = read(data, &_cycle_clock, sizeof(_cycle_clock));
+        data = read(data, &_timer_clock, sizeof(_timer_clock));
+        read(data, &_sample_clock, sizeof(_sample_clock));
+        return true;
+    }
+
+    uint64_t state_hash() {
+        return visit([](auto& cpu) { return cpu.state_hash(); });
+    }
+
+    void set_keypad(uint16_t state) {
+        visit([&](auto& cpu) { cpu.set_keypad(state); });
+    }
+
+    unsigned width() { return visit([](auto& cpu) { return static_cast<unsigned>(cpu.screen_width()); }); }
+    unsigned height() { return visit([](auto& cpu) { return static_cast<unsigned>(cpu.screen_height()); }); }
+
+    void render() {
+        visit([&](auto& cpu) {
+            _video.compose(cpu.vram(0), cpu.vram(1), cpu.screen_width(), cpu.screen_height(), palette);
+        });
+    }
+
+    size_t render_audio(size_t count) {
+        return visit([&](auto& cpu) { return _audio.render(cpu.sound(), cpu.pattern(), cpu.pitch(), count); });
+    }
+
+    size_t samples() const { return _samples; }
+
+    // Convert elapsed host time into CPU cycles, 60 Hz timer ticks and audio
+    // samples, carrying remainders so no rate drifts over time. The cycle
+    // budget is split into `slices` with `poll` called before each one.
+    template<typename Poll>
+    void run(retro_usec_t usec, unsigned slices, Poll&& poll) {
+        if (usec < 0) usec = 0;
+        if (usec > max_frame_usec) usec = max_frame_usec;
+        const auto elapsed = static_cast<uint64_t>(usec);
+
+        const auto cycles = advance(_cycle_clock, elapsed * _cycles_per_frame * timer_rate);
+        const auto ticks = advance(_timer_clock, elapsed * timer_rate);
+        _samples = static_cast<size_t>(advance(_sample_clock, elapsed * audio::sample_rate));
+
+        const auto engine = _fastforward ? chip8::fastest_engine : _engine;
+        if (slices == 0) slices = 1;
+        for (unsigned slice = 0; slice < slices; ++slice) {
+            poll();
+            const auto begin = cycles * slice / slices;
+            const auto end = cycles * (slice + 1) / slices;
+            visit([&](auto& cpu) { cpu.run(end - begin, engine); });
+        }
+
+        visit([&](auto& cpu) {
+            for (uint64_t i = 0; i < ticks; ++i) cpu.update_timers();
+        });
+    }
 
 private:
-    cpu _cpu;
+    void emplace(variant type) {
+        switch (type) {
+        case variant::cosmac_vip: _cpu.emplace<chip8::cpu<chip8::quirks::cosmac_vip>>(); break;
+        case variant::schip: _cpu.emplace<chip8::cpu<chip8::quirks::schip>>(); break;
+        case variant::xo_chip: _cpu.emplace<chip8::cpu<chip8::quirks::xo_chip>>(); break;
+        }
+    }
+
+    // The CPU state is padded to the largest alternative so the state size
+    // never depends on the loaded variant.
+    template<typename Serialize>
+    static uint8_t* write(uint8_t* data, Serialize&& serialize) {
+        memset(data, 0, sizeof(machine));
+        serialize(data);
+        return data + sizeof(machine);
+    }
+
+    template<typename Unserialize>
+    static const uint8_t* read(const uint8_t* data, Unserialize&& unserialize) {
+        unserialize(data);
+        return data + sizeof(machine);
+    }
+
+    template<typename T>
+    static uint8_t* write(uint8_t* data, const T* value, size_t size) {
+        static_assert(std::is_trivially_copyable_v<T>, "state must be trivially copyable");
+        memset(data, 0, size);
+        memcpy(data, value, sizeof(T));
+        return data + size;
+    }
+
+    template<typename T>
+    static const uint8_t* read(const uint8_t* data, T* value, size_t size) {
+        static_assert(std::is_trivially_copyable_v<T>, "state must be trivially copyable");
+        memcpy(value, data, sizeof(T));
+        return data + size;
+    }
+
+    static uint64_t advance(uint64_t& clock, uint64_t amount) {
+        clock += amount;
+        const auto whole = clock / usec_per_second;
+        clock %= usec_per_second;
+        return whole;
+    }
+
+    machine _cpu;
+    variant _type = variant::cosmac_vip;
+    std::vector<uint8_t> _rom;
+
+    size_t _cycles_per_frame = default_cycles_per_frame;
+    chip8::engine _engine = chip8::engine::switch_case;
+    bool _fastforward = false;
+    bool _idle_skip = false;
+    bool _seed_from_content = true;
+    uint64_t _seed = 0;
+    chip8::aot::run_t _translation = nullptr;
+
     video _video;
+    audio _audio;
+
+    uint64_t _cycle_clock = 0;
+    uint64_t _timer_clock = 0;
+    uint64_t _sample_clock = 0;
+    size_t _samples = audio::samples_per_frame;
 };
 
 emu s_emu;
@@ -35,6 +277,31 @@ retro_input_poll_t input_poll_cb;
 retro_input_state_t input_state_cb;
 retro_log_printf_t log_cb;
 
+double refresh_rate = emu::fps;
+retro_usec_t frame_time = emu::frame_usec;
+
+unsigned input_slices = 1;
+enum class frameskip_mode {
+    fixed,
+    automatic,
+};
+
+frameskip_mode frameskip_type = frameskip_mode::fixed;
+unsigned frameskip = 0;
+unsigned frameskip_threshold = 33;
+
+bool can_dupe = false;
+bool log_state_hash = false;
+uint64_t frame_count = 0;
+
+#if defined(CHIP8_AOT)
+void* aot_plugin = nullptr;
+#endif
+bool input_bitmasks = false;
+uint16_t keyboard_keypad = 0;
+bool fastforward_override = false;
+float fastforward_ratio = -1.0f;
+
 void fallback_log(enum retro_log_level level, const char* fmt, ...)
 {
     (void)level;
@@ -44,6 +311,41 @@ void fallback_log(enum retro_log_level level, const char* fmt, ...)
     va_end(va);
 }
 
+#if defined(CHIP8_AOT)
+// Looks for <system directory>/chip8_aot/<rom hash>.so, as produced by
+// chip8_recompile, and hands its translated code to the emulator.
+void load_aot_plugin()
+{
+    const char* dir = nullptr;
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, &dir) || !dir)
+        return;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/chip8_aot/%016llx.so", dir, static_cast<unsigned long long>(s_emu.rom_hash()));
+    aot_plugin = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!aot_plugin)
+        return;
+
+    const auto entry = reinterpret_cast<chip8::aot::entry_t>(dlsym(aot_plugin, chip8::aot::entry_point));
+    if (entry && s_emu.set_translation(entry())) {
+        log_cb(RETRO_LOG_INFO, "Using translated code from %s.\n", path);
+        return;
+    }
+
+    log_cb(RETRO_LOG_WARN, "Ignoring %s: built for a different ROM or core.\n", path);
+    dlclose(aot_plugin);
+    aot_plugin = nullptr;
+}
+
+void unload_aot_plugin()
+{
+    s_emu.set_translation(nullptr);
+    if (aot_plugin)
+        dlclose(aot_plugin);
+    aot_plugin = nullptr;
+}
+#endif
+
 } // namespace
 
 void retro_init(void)
@@ -76,16 +378,160 @@ void retro_get_system_info(struct retro_system_info* info)
 
 void retro_get_system_av_info(struct retro_system_av_info* info)
 {
-    info->timing.fps = emu::fps;
+    info->timing.fps = refresh_rate;
     info->timing.sample_rate = emu::sample_rate;
 
-    info->geometry.base_width = emu::video::width;
-    info->geometry.base_height = emu::video::height;
+    info->geometry.base_width = emu::base_width;
+    info->geometry.base_height = emu::base_height;
     info->geometry.max_width = emu::video::width;
     info->geometry.max_height = emu::video::height;
     info->geometry.aspect_ratio = emu::video::aspect_ratio;
 }
 
+static retro_core_option_v2_category option_categories[] = {
+    { "system", "System", "Emulation speed and interpreter settings." },
+    { "video", "Video", "Presentation settings." },
+    { "audio", "Audio", "Sound synthesis settings." },
+    { "input", "Input", "Input sampling settings." },
+    { nullptr, nullptr, nullptr },
+};
+
+static retro_core_option_v2_definition option_definitions[] = {
+    {
+        "chip8_cycles_per_frame", "Instructions per Frame", nullptr,
+        "Number of CHIP-8 instructions executed per 60 Hz frame.", nullptr,
+        "system",
+        {
+            { "7", nullptr }, { "10", nullptr }, { "15", nullptr }, { "20", nullptr },
+            { "30", nullptr }, { "50", nullptr }, { "100", nullptr }, { "200", nullptr },
+            { "500", nullptr }, { "1000", nullptr }, { "2000", nullptr }, { nullptr, nullptr },
+        },
+        "10",
+    },
+    {
+        "chip8_dispatch", "Dispatch Engine", nullptr,
+        "Interpreter dispatch strategy. Results are identical; speed depends on the host CPU.", nullptr,
+        "system",
+        {
+            { "switch", "Switch" }, { "table", "Handler Table" },
+#if CHIP8_HAS_THREADED_DISPATCH
+            { "threaded", "Threaded (computed goto)" },
+#endif
+            { "cached", "Predecoded (fused)" }, { nullptr, nullptr },
+        },
+        "switch",
+    },
+    {
+        "chip8_idle_skip", "Idle Loop Skipping", nullptr,
+        "Stop executing for the rest of the frame when the program spins in a jump-to-self or delay timer wait loop.", nullptr,
+        "system",
+        {
+            { "disabled", nullptr }, { "enabled", nullptr }, { nullptr, nullptr },
+        },
+        "disabled",
+    },
+    {
+        "chip8_random_seed", "Random Seed", nullptr,
+        "Seed for the CXNN random number instruction, applied on reset. 'From Content' replays identically for each ROM; 'Random' differs every session.", nullptr,
+        "system",
+        {
+            { "content", "From Content" }, { "random", "Random" }, { "1", nullptr }, { "2", nullptr },
+            { "3", nullptr }, { "4", nullptr }, { "5", nullptr }, { nullptr, nullptr },
+        },
+        "content",
+    },
+    {
+        "chip8_log_state_hash", "Log State Hash", nullptr,
+        "Log a hash of the complete emulated state after every frame, for tracking down netplay or replay desyncs.", nullptr,
+        "system",
+        {
+            { "disabled", nullptr }, { "enabled", nullptr }, { nullptr, nullptr },
+        },
+        "disabled",
+    },
+    {
+        "chip8_fastforward_ratio", "Fast-Forward Speed", nullptr,
+        "Speed limit requested from the frontend while fast-forwarding.", nullptr,
+        "system",
+        {
+            { "default", "Frontend Default" }, { "2", "2x" }, { "4", "4x" }, { "8", "8x" },
+            { "16", "16x" }, { "unlimited", "Unlimited" }, { nullptr, nullptr },
+        },
+        "default",
+    },
+    {
+        "chip8_frameskip", "Frameskip", nullptr,
+        "Number of frames left unrendered after each presented frame. 'Auto' skips frames while the frontend audio buffer runs low. The CPU always runs.", nullptr,
+        "video",
+        {
+            { "0", nullptr }, { "1", nullptr }, { "2", nullptr }, { "3", nullptr }, { "4", nullptr },
+            { "auto", "Auto" }, { nullptr, nullptr },
+        },
+        "0",
+    },
+    {
+        "chip8_frameskip_threshold", "Auto Frameskip Threshold (%)", nullptr,
+        "Audio buffer occupancy below which 'Auto' frameskip drops frames.", nullptr,
+        "video",
+        {
+            { "15", nullptr }, { "20", nullptr }, { "25", nullptr }, { "33", nullptr },
+            { "40", nullptr }, { "50", nullptr }, { "60", nullptr }, { nullptr, nullptr },
+        },
+        "33",
+    },
+    {
+        "chip8_audio_quality", "Audio Quality", nullptr,
+        "Band-limited synthesis removes aliasing from the buzzer; naive synthesis is cheaper.", nullptr,
+        "audio",
+        {
+            { "band_limited", "Band-Limited" }, { "naive", "Naive" }, { nullptr, nullptr },
+        },
+        "band_limited",
+    },
+    {
+        "chip8_input_slices", "Input Polls per Frame", nullptr,
+        "Split each frame into slices and poll input before each to reduce latency.", nullptr,
+        "input",
+        {
+            { "1", nullptr }, { "2", nullptr }, { "4", nullptr }, { "8", nullptr }, { nullptr, nullptr },
+        },
+        "1",
+    },
+    { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, {{ nullptr, nullptr }}, nullptr },
+};
+
+static void set_core_options(retro_environment_t cb)
+{
+    unsigned version = 0;
+    if (!cb(RETRO_ENVIRONMENT_GET_CORE_OPTIONS_VERSION, &version))
+        version = 0;
+
+    if (version >= 2)
+    {
+        retro_core_options_v2 options{ option_categories, option_definitions };
+        cb(RETRO_ENVIRONMENT_SET_CORE_OPTIONS_V2, &options);
+        return;
+    }
+
+    // Legacy frontends take "Description; default|other|..." strings.
+    static constexpr size_t num_options = sizeof(option_definitions) / sizeof(option_definitions[0]);
+    static char descriptions[num_options][512];
+    static retro_variable variables[num_options];
+
+    for (size_t i = 0; option_definitions[i].key; ++i)
+    {
+        const auto& option = option_definitions[i];
+        size_t length = snprintf(descriptions[i], sizeof(descriptions[i]), "%s; %s", option.desc, option.default_value);
+        for (const auto* value = option.values; value->value && length < sizeof(descriptions[i]); ++value)
+        {
+            if (strcmp(value->value, option.default_value) != 0)
+                length += snprintf(descriptions[i] + length, sizeof(descriptions[i]) - length, "|%s", value->value);
+        }
+        variables[i] = { option.key, descriptions[i] };
+    }
+    cb(RETRO_ENVIRONMENT_SET_VARIABLES, variables);
+}
+
 void retro_set_environment(retro_environment_t cb)
 {
     environ_cb = cb;
@@ -93,6 +539,8 @@ void retro_set_environment(retro_environment_t cb)
     bool no_content = true;
     cb(RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME, &no_content);
 
+    set_core_options(cb);
+
     retro_log_callback logging{};
     if (cb(RETRO_ENVIRONMENT_GET_LOG_INTERFACE, &logging))
         log_cb = logging.log;
@@ -125,65 +573,352 @@ void retro_set_video_refresh(retro_video_refresh_t cb)
     video_cb = cb;
 }
 
-static unsigned x_coord;
-static unsigned y_coord;
-static int mouse_rel_x;
-static int mouse_rel_y;
+static void frame_time_callback(retro_usec_t usec)
+{
+    frame_time = usec;
+}
+
+static unsigned geometry_width = emu::base_width;
+static unsigned geometry_height = emu::base_height;
 
 void retro_reset(void)
 {
-    x_coord = 0;
-    y_coord = 0;
+    s_emu.reset();
+    frame_count = 0;
 }
 
-static void update_input(void)
+static constexpr uint16_t keypad_bit(chip8::key key)
 {
-    input_poll_cb();
-    if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_UP))
+    return static_cast<uint16_t>(1 << chip8::cpu<>::key_value(key));
+}
+
+static void keyboard_callback(bool down, unsigned keycode, uint32_t character, uint16_t key_modifiers)
+{
+    // The COSMAC VIP hex pad laid over the left-hand 4x4 block of a keyboard.
+    static constexpr struct {
+        unsigned keycode;
+        chip8::key key;
+    } keymap[] = {
+        { RETROK_1, chip8::key::key_1 }, { RETROK_2, chip8::key::key_2 },
+        { RETROK_3, chip8::key::key_3 }, { RETROK_4, chip8::key::key_c },
+        { RETROK_q, chip8::key::key_4 }, { RETROK_w, chip8::key::key_5 },
+        { RETROK_e, chip8::key::key_6 }, { RETROK_r, chip8::key::key_d },
+        { RETROK_a, chip8::key::key_7 }, { RETROK_s, chip8::key::key_8 },
+        { RETROK_d, chip8::key::key_9 }, { RETROK_f, chip8::key::key_e },
+        { RETROK_z, chip8::key::key_a }, { RETROK_x, chip8::key::key_0 },
+        { RETROK_c, chip8::key::key_b }, { RETROK_v, chip8::key::key_f },
+    };
+
+    (void)character;
+    (void)key_modifiers;
+
+    for (const auto& map : keymap)
     {
-        /* stub */
+        if (map.keycode != keycode)
+            continue;
+
+        if (down)
+            keyboard_keypad |= keypad_bit(map.key);
+        else
+            keyboard_keypad &= ~keypad_bit(map.key);
+        break;
     }
 }
 
-static void render_checkered(void)
+static void update_input(void)
 {
-    uint32_t* buf = s_emu.framebuffer();
-    unsigned stride = emu::video::width;
-    uint32_t color_r = 0xff << 16;
-    uint32_t color_g = 0xff << 8;
-    uint32_t* line = buf;
+    static constexpr struct {
+        unsigned id;
+        chip8::key key;
+    } keymap[] = {
+        { RETRO_DEVICE_ID_JOYPAD_UP, chip8::key::key_2 },
+        { RETRO_DEVICE_ID_JOYPAD_DOWN, chip8::key::key_8 },
+        { RETRO_DEVICE_ID_JOYPAD_LEFT, chip8::key::key_4 },
+        { RETRO_DEVICE_ID_JOYPAD_RIGHT, chip8::key::key_6 },
+        { RETRO_DEVICE_ID_JOYPAD_A, chip8::key::key_5 },
+        { RETRO_DEVICE_ID_JOYPAD_B, chip8::key::key_0 },
+        { RETRO_DEVICE_ID_JOYPAD_X, chip8::key::key_a },
+        { RETRO_DEVICE_ID_JOYPAD_Y, chip8::key::key_b },
+        { RETRO_DEVICE_ID_JOYPAD_L, chip8::key::key_c },
+        { RETRO_DEVICE_ID_JOYPAD_R, chip8::key::key_d },
+        { RETRO_DEVICE_ID_JOYPAD_SELECT, chip8::key::key_e },
+        { RETRO_DEVICE_ID_JOYPAD_START, chip8::key::key_f },
+    };
 
-    for (unsigned y = 0; y < emu::video::height; y++, line += stride)
+    input_poll_cb();
+
+    uint32_t buttons = 0;
+    if (input_bitmasks)
+    {
+        buttons = static_cast<uint16_t>(input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_MASK));
+    }
+    else
     {
-        unsigned index_y = ((y - y_coord) >> 4) & 1;
-        for (unsigned x = 0; x < emu::video::width; x++)
+        for (const auto& map : keymap)
         {
-            unsigned index_x = ((x - x_coord) >> 4) & 1;
-            line[x] = (index_y ^ index_x) ? color_r : color_g;
+            if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, map.id))
+                buttons |= 1u << map.id;
         }
     }
 
-    for (unsigned y = mouse_rel_y - 5; y <= mouse_rel_y + 5; y++)
-        for (unsigned x = mouse_rel_x - 5; x <= mouse_rel_x + 5; x++)
-            buf[y * stride + x] = 0xff;
+    uint16_t keypad = keyboard_keypad;
+    for (const auto& map : keymap)
+    {
+        if (buttons & (1u << map.id))
+            keypad |= keypad_bit(map.key);
+    }
+    s_emu.set_keypad(keypad);
+}
+
+static void update_geometry(unsigned width, unsigned height)
+{
+    if (width == geometry_width && height == geometry_height)
+        return;
+
+    retro_game_geometry geometry{};
+    geometry.base_width = width;
+    geometry.base_height = height;
+    geometry.max_width = emu::video::width;
+    geometry.max_height = emu::video::height;
+    geometry.aspect_ratio = static_cast<float>(width) / static_cast<float>(height);
+    environ_cb(RETRO_ENVIRONMENT_SET_GEOMETRY, &geometry);
+
+    geometry_width = width;
+    geometry_height = height;
+}
+
+static void dupe_video(void)
+{
+    video_cb(nullptr, geometry_width, geometry_height, emu::video::width * sizeof(emu::video::pixel_t));
+}
+
+static void render_video(void)
+{
+    const unsigned width = s_emu.width();
+    const unsigned height = s_emu.height();
+    update_geometry(width, height);
 
-    video_cb(buf, emu::video::width, emu::video::height, stride << 2);
+    s_emu.render();
+    video_cb(s_emu.framebuffer(), width, height, emu::video::width * sizeof(emu::video::pixel_t));
+}
+
+static const char* get_variable(const char* key)
+{
+    retro_variable var{ key, nullptr };
+    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+        return var.value;
+    return nullptr;
 }
 
 static void check_variables(void)
 {
+    if (const char* value = get_variable("chip8_cycles_per_frame"))
+    {
+        const auto cycles = strtoul(value, nullptr, 10);
+        s_emu.set_cycles_per_frame(cycles ? cycles : emu::default_cycles_per_frame);
+    }
+
+    if (const char* value = get_variable("chip8_dispatch"))
+    {
+        if (strcmp(value, "table") == 0)
+            s_emu.set_engine(chip8::engine::table);
+        else if (strcmp(value, "threaded") == 0)
+            s_emu.set_engine(chip8::engine::threaded);
+        else if (strcmp(value, "cached") == 0)
+            s_emu.set_engine(chip8::engine::cached);
+        else
+            s_emu.set_engine(chip8::engine::switch_case);
+    }
+
+    if (const char* value = get_variable("chip8_idle_skip"))
+        s_emu.set_idle_skip(strcmp(value, "enabled") == 0);
+
+    if (const char* value = get_variable("chip8_random_seed"))
+    {
+        if (strcmp(value, "content") == 0)
+            s_emu.set_random_seed(true, 0);
+        else if (strcmp(value, "random") == 0)
+            s_emu.set_random_seed(false, static_cast<uint64_t>(time(nullptr)) * 0x9E3779B97F4A7C15ull);
+        else
+            s_emu.set_random_seed(false, strtoull(value, nullptr, 10));
+    }
+
+    if (const char* value = get_variable("chip8_log_state_hash"))
+        log_state_hash = strcmp(value, "enabled") == 0;
+
+    if (const char* value = get_variable("chip8_fastforward_ratio"))
+    {
+        if (strcmp(value, "default") == 0)
+            fastforward_ratio = -1.0f;
+        else if (strcmp(value, "unlimited") == 0)
+            fastforward_ratio = 0.0f;
+        else
+            fastforward_ratio = static_cast<float>(strtod(value, nullptr));
+    }
+
+    if (const char* value = get_variable("chip8_frameskip"))
+    {
+        frameskip_type = (strcmp(value, "auto") == 0) ? frameskip_mode::automatic : frameskip_mode::fixed;
+        frameskip = static_cast<unsigned>(strtoul(value, nullptr, 10));
+    }
+
+    if (const char* value = get_variable("chip8_frameskip_threshold"))
+        frameskip_threshold = static_cast<unsigned>(strtoul(value, nullptr, 10));
+
+    if (const char* value = get_variable("chip8_audio_quality"))
+    {
+        if (strcmp(value, "naive") == 0)
+            s_emu.set_audio_quality(emu::audio::quality::naive);
+        else
+            s_emu.set_audio_quality(emu::audio::quality::band_limited);
+    }
+
+    if (const char* value = get_variable("chip8_input_slices"))
+        input_slices = static_cast<unsigned>(strtoul(value, nullptr, 10));
+    if (input_slices == 0)
+        input_slices = 1;
+}
+
+static struct {
+    bool active;
+    unsigned occupancy;
+    bool underrun_likely;
+} audio_buffer_status;
+
+static void audio_buffer_status_callback(bool active, unsigned occupancy, bool underrun_likely)
+{
+    audio_buffer_status.active = active;
+    audio_buffer_status.occupancy = occupancy;
+    audio_buffer_status.underrun_likely = underrun_likely;
+}
+
+// Nudge the number of samples per frame to hold the frontend queue near
+// the target occupancy instead of letting it drift full.
+static size_t audio_frames(void)
+{
+    const int nominal = static_cast<int>(s_emu.samples());
+    const int max_deviation = nominal / 50;
+    constexpr int target_occupancy = 50;
+
+    if (!audio_buffer_status.active)
+        return nominal;
+    if (audio_buffer_status.underrun_likely)
+        return nominal + max_deviation;
+
+    const int error = target_occupancy - static_cast<int>(audio_buffer_status.occupancy);
+    return nominal + max_deviation * error / target_occupancy;
 }
 
-static void audio_callback(void)
+// The synthesiser advances every frame, even when the frontend discards the
+// audio, so the next delivered frame sounds as if nothing had been dropped.
+static void audio_callback(bool deliver)
 {
-    audio_cb(0, 0);
+    const size_t frames = s_emu.render_audio(audio_frames());
+    if (deliver)
+        audio_batch_cb(s_emu.audio_buffer(), frames);
+}
+
+// Fixed mode drops N frames after each presented one. Auto mode drops frames
+// while the frontend audio buffer is draining, up to a few in a row, so the
+// host spends its time producing audio instead of video.
+static bool skip_frame(void)
+{
+    static unsigned skipped_frames = 0;
+
+    bool skip = false;
+    switch (frameskip_type)
+    {
+    case frameskip_mode::fixed:
+        skip = skipped_frames < frameskip;
+        break;
+    case frameskip_mode::automatic:
+        skip = audio_buffer_status.active
+            && (audio_buffer_status.underrun_likely || audio_buffer_status.occupancy < frameskip_threshold)
+            && skipped_frames < emu::max_auto_frameskip;
+        break;
+    }
+
+    skipped_frames = skip ? skipped_frames + 1 : 0;
+    return skip;
+}
+
+// Ask the frontend to use our ratio each time it enters fast-forward.
+static void update_fastforward(bool fastforward)
+{
+    static bool was_fastforwarding = false;
+    if (fastforward && !was_fastforwarding && fastforward_override && fastforward_ratio >= 0.0f)
+    {
+        retro_fastforwarding_override ff{};
+        ff.ratio = fastforward_ratio;
+        ff.fastforward = true;
+        ff.notification = true;
+        ff.inhibit_toggle = false;
+        environ_cb(RETRO_ENVIRONMENT_SET_FASTFORWARDING_OVERRIDE, &ff);
+    }
+    was_fastforwarding = fastforward;
+}
+
+// How many frames a display can show at most one of while fast-forwarding.
+// Only known when the core set the ratio itself; with the frontend's own
+// ratio every frame is expanded.
+static unsigned fastforward_present_interval(void)
+{
+    if (!fastforward_override || fastforward_ratio < 0.0f)
+        return 1;
+    if (fastforward_ratio == 0.0f)
+        return emu::max_fastforward_present_interval;
+    const auto interval = static_cast<unsigned>(ceil(fastforward_ratio));
+    return interval < emu::max_fastforward_present_interval ? interval : emu::max_fastforward_present_interval;
 }
 
 void retro_run(void)
 {
-    update_input();
-    render_checkered();
-    audio_callback();
+    static unsigned fastforward_frame = 0;
+
+    bool fastforward = false;
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_FASTFORWARDING, &fastforward))
+        fastforward = false;
+    update_fastforward(fastforward);
+    s_emu.set_fastforward(fastforward);
+
+    // Run-ahead and netplay replays discard output, which the frontend
+    // reports through bit 0 (video), bit 1 (audio) and bit 3 (audio hard off).
+    int av_enable = 0x3;
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+        av_enable = 0x3;
+    bool present_video = (av_enable & 0x1) != 0;
+    bool present_audio = (av_enable & 0x2) != 0 && (av_enable & 0x8) == 0;
+
+    s_emu.run(frame_time, input_slices, update_input);
+    ++frame_count;
+    if (log_state_hash)
+        log_cb(RETRO_LOG_INFO, "Frame %llu state %016llx\n", static_cast<unsigned long long>(frame_count),
+            static_cast<unsigned long long>(s_emu.state_hash()));
+
+    // While fast-forwarding the frontend shows only a fraction of the frames,
+    // so only expand the occasional frame. Duped frames send no audio either;
+    // presented ones keep theirs for frontends that play fast-forward audio.
+    if (fastforward)
+    {
+        fastforward_frame = (fastforward_frame + 1) % fastforward_present_interval();
+        const bool shown = fastforward_frame == 0 || !can_dupe;
+        present_video = present_video && shown;
+        present_audio = present_audio && shown;
+    }
+    else
+    {
+        fastforward_frame = 0;
+    }
+
+    if (present_video && can_dupe && skip_frame())
+        present_video = false;
+
+    if (present_video)
+        render_video();
+    else if (can_dupe)
+        dupe_video();
+
+    audio_callback(present_audio);
 
     bool updated = false;
     if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
@@ -201,12 +936,53 @@ bool retro_load_game(const struct retro_game_info* info)
 
     check_variables();
 
-    (void)info;
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_CAN_DUPE, &can_dupe))
+        can_dupe = false;
+    input_bitmasks = environ_cb(RETRO_ENVIRONMENT_GET_INPUT_BITMASKS, nullptr);
+
+    // A previous game may have left the frontend in hi-res.
+    geometry_width = emu::base_width;
+    geometry_height = emu::base_height;
+
+    keyboard_keypad = 0;
+    retro_keyboard_callback keyboard{ keyboard_callback };
+    environ_cb(RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK, &keyboard);
+    fastforward_override = environ_cb(RETRO_ENVIRONMENT_SET_FASTFORWARDING_OVERRIDE, nullptr);
+
+    retro_audio_buffer_status_callback buffer_status{ audio_buffer_status_callback };
+    environ_cb(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, &buffer_status);
+
+    float target_refresh_rate = 0.0f;
+    if (environ_cb(RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE, &target_refresh_rate) && target_refresh_rate > 0.0f)
+        refresh_rate = target_refresh_rate;
+
+    frame_time = static_cast<retro_usec_t>(1000000.0 / refresh_rate);
+    retro_frame_time_callback frame_time_cb{ frame_time_callback, frame_time };
+    environ_cb(RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK, &frame_time_cb);
+
+    const auto type = chip8::variant_from_path(info ? info->path : nullptr);
+
+    if (info && info->data)
+        s_emu.load(type, static_cast<const uint8_t*>(info->data), info->size);
+    else
+        s_emu.load(type, nullptr, 0);
+    frame_count = 0;
+
+#if defined(CHIP8_AOT)
+    load_aot_plugin();
+#endif
+
     return true;
 }
 
 void retro_unload_game(void)
 {
+    environ_cb(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, nullptr);
+    audio_buffer_status.active = false;
+
+#if defined(CHIP8_AOT)
+    unload_aot_plugin();
+#endif
 }
 
 unsigned retro_get_region(void)
@@ -225,29 +1001,17 @@ bool retro_load_game_special(unsigned type, const struct retro_game_info* info,
 
 size_t retro_serialize_size(void)
 {
-    return 2;
+    return emu::state_size;
 }
 
 bool retro_serialize(void* data_, size_t size)
 {
-    if (size < 2)
-        return false;
-
-    uint8_t* data = reinterpret_cast<uint8_t*>(data_);
-    data[0] = x_coord;
-    data[1] = y_coord;
-    return true;
+    return s_emu.serialize(reinterpret_cast<uint8_t*>(data_), size);
 }
 
 bool retro_unserialize(const void* data_, size_t size)
 {
-    if (size < 2)
-        return false;
-
-    const uint8_t* data = reinterpret_cast<const uint8_t*>(data_);
-    x_coord = data[0] & 31;
-    y_coord = data[1] & 31;
-    return true;
+    return s_emu.unserialize(reinterpret_cast<const uint8_t*>(data_), size);
 }
 
 void* retro_get_memory_data(unsigned id)
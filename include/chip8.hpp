@@ -1,7 +1,24 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
 #include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CHIP8_HAS_SSE2 1
+#else
+#define CHIP8_HAS_SSE2 0
+#endif
 
 namespace chip8 {
 
@@ -25,55 +42,521 @@ enum class key : size_t {
 	key_num,
 };
 
-template<typename DataType = uint8_t, size_t Size = 4098>
-class memory {
+namespace detail {
+
+// XXH64, for keying ROMs by content and hashing state.
+constexpr uint64_t xxh64_prime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t xxh64_prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t xxh64_prime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t xxh64_prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t xxh64_prime5 = 0x27D4EB2F165667C5ULL;
+
+constexpr uint64_t rotl64(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+constexpr uint64_t read_le32(const uint8_t *data) {
+	return static_cast<uint64_t>(data[0]) | (static_cast<uint64_t>(data[1]) << 8) |
+		(static_cast<uint64_t>(data[2]) << 16) | (static_cast<uint64_t>(data[3]) << 24);
+}
+
+constexpr uint64_t read_le64(const uint8_t *data) {
+	return read_le32(data) | (read_le32(data + 4) << 32);
+}
+
+constexpr uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+	return rotl64(acc + input * xxh64_prime2, 31) * xxh64_prime1;
+}
+
+constexpr uint64_t xxh64_merge(uint64_t acc, uint64_t value) {
+	return (acc ^ xxh64_round(0, value)) * xxh64_prime1 + xxh64_prime4;
+}
+
+constexpr uint64_t xxh64(const uint8_t *data, size_t size, uint64_t seed = 0) {
+	const uint8_t *const end = data + size;
+	uint64_t hash = 0;
+
+	if (size >= 32) {
+		uint64_t v1 = seed + xxh64_prime1 + xxh64_prime2;
+		uint64_t v2 = seed + xxh64_prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - xxh64_prime1;
+		for (; end - data >= 32; data += 32) {
+			v1 = xxh64_round(v1, read_le64(data));
+			v2 = xxh64_round(v2, read_le64(data + 8));
+			v3 = xxh64_round(v3, read_le64(data + 16));
+			v4 = xxh64_round(v4, read_le64(data + 24));
+		}
+		hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		hash = xxh64_merge(hash, v1);
+		hash = xxh64_merge(hash, v2);
+		hash = xxh64_merge(hash, v3);
+		hash = xxh64_merge(hash, v4);
+	} else {
+		hash = seed + xxh64_prime5;
+	}
+
+	hash += size;
+	for (; end - data >= 8; data += 8) {
+		hash ^= xxh64_round(0, read_le64(data));
+		hash = rotl64(hash, 27) * xxh64_prime1 + xxh64_prime4;
+	}
+	if (end - data >= 4) {
+		hash ^= read_le32(data) * xxh64_prime1;
+		hash = rotl64(hash, 23) * xxh64_prime2 + xxh64_prime3;
+		data += 4;
+	}
+	for (; data < end; ++data) {
+		hash ^= *data * xxh64_prime5;
+		hash = rotl64(hash, 11) * xxh64_prime1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= xxh64_prime2;
+	hash ^= hash >> 29;
+	hash *= xxh64_prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+} // namespace detail
+
+// How memory treats an address at or past its size.
+namespace addressing {
+
+// The address wraps around, as if the upper address lines were not wired.
+// Needs a power-of-two size; every access is a single AND.
+struct masked {};
+
+// The access is reported through the fault hook, then a read returns 0 and a
+// write is dropped.
+struct checked {};
+
+// No check at all, for callers that have proven every address in range.
+struct unchecked {};
+
+} // namespace addressing
+
+// Receives out-of-range accesses to checked memory.
+using fault_hook_t = void (*)(void *context, size_t address, bool write);
+
+namespace addressing {
+
+// The contents of a memory and its dirty pages, plus the fault hook only
+// where it is used. All members live here so that memory stays a
+// standard-layout type.
+template<typename Addressing, typename Storage, typename Dirty>
+struct slot {
+	Storage _data;
+	Dirty _dirty{};
+};
+
+template<typename Storage, typename Dirty>
+struct slot<checked, Storage, Dirty> {
+	Storage _data;
+	Dirty _dirty{};
+	fault_hook_t _hook = nullptr;
+	void *_context = nullptr;
+};
+
+} // namespace addressing
+
+// Writes mark 256-byte pages dirty, so a hash of the contents only needs
+// to revisit the pages written since it was last taken.
+constexpr size_t memory_page_size = 256;
+
+template<size_t Size>
+using dirty_pages_t = std::array<uint64_t, ((Size + memory_page_size - 1) / memory_page_size + 63) / 64>;
+
+template<typename DataType = uint8_t, size_t Size = 4096, typename Addressing = addressing::checked>
+class memory : private addressing::slot<Addressing, std::array<DataType, Size>, dirty_pages_t<Size>> {
 public:
 	using data_t = DataType;
+	using addressing_t = Addressing;
+	using storage_t = std::array<data_t, Size>;
 	static constexpr size_t size = Size;
+	static constexpr size_t page_size = memory_page_size;
+	static constexpr size_t num_pages = (size + page_size - 1) / page_size;
+	static constexpr bool wraps = std::is_same_v<addressing_t, addressing::masked>;
+	static constexpr bool checked = std::is_same_v<addressing_t, addressing::checked>;
+
+	static_assert(!wraps || (size & (size - 1)) == 0, "masked addressing needs a power-of-two size");
+
+	// Where `index` ends up for masked memory; unchanged otherwise.
+	static constexpr size_t locate(size_t index) { return wraps ? (index & (size - 1)) : index; }
+
+	constexpr auto data() const { return this->_data.data(); }
 
-	constexpr auto data() const { return _data.data(); }
+	// The contents alone, without the fault hook. Writing through the
+	// mutable reference bypasses dirty tracking; call mark_dirty() after.
+	constexpr storage_t &storage() { return this->_data; }
+	constexpr const storage_t &storage() const { return this->_data; }
 
 	constexpr void clear() {
-		_data.fill(0);
+		this->_data.fill(0);
+		mark_dirty();
 	}
 
-	constexpr void write(data_t *data, size_t data_size, size_t position = 0) {
+	constexpr void mark_dirty() {
+		this->_dirty.fill(~uint64_t{ 0 });
+	}
+
+	// Calls `function(page, data, length)` for every dirty page, then marks
+	// them all clean.
+	template<typename Function>
+	constexpr void take_dirty(Function &&function) {
+		for (size_t page = 0; page < num_pages; ++page) {
+			const auto word = this->_dirty[page / 64];
+			if (word == 0) {
+				page |= 63;
+			} else if ((word >> (page % 64)) & 1) {
+				const size_t offset = page * page_size;
+				function(page, this->_data.data() + offset, std::min(page_size, size - offset));
+			}
+		}
+		this->_dirty.fill(0);
+	}
+
+	void set_fault_hook(fault_hook_t hook, void *context) {
+		static_assert(checked, "only checked memory reports faults");
+		this->_hook = hook;
+		this->_context = context;
+	}
+
+	// Bulk writes only happen at load time, so they are bounds-checked
+	// whatever the policy and never wrap.
+	constexpr void write(const data_t *data, size_t data_size, size_t position = 0) {
 		const auto end = position + data_size;
 		if (end > size) {
 			// over.
+			fault(position, true);
 
 		} else {
-			memcpy(_data.data() + position, data, data_size);
+			memcpy(this->_data.data() + position, data, data_size);
+			for (size_t page = position / page_size; page * page_size < end; ++page) mark_page(page);
 		}
 	}
 
 	constexpr void write(data_t data, size_t position = 0) {
-		if (position > size) {
-			// over.
+		if constexpr (checked) {
+			if (position >= size) {
+				// over.
+				fault(position, true);
+				return;
+			}
+		}
+		const auto address = locate(position);
+		this->_data[address] = data;
+		mark_page(address / page_size);
+	}
 
-		} else {
-			_data[position] = data;
+	constexpr data_t read(size_t index) const {
+		if constexpr (checked) {
+			if (index >= size) {
+				fault(index, false);
+				return 0;
+			}
+		}
+		return this->_data[locate(index)];
+	}
+
+private:
+	constexpr void mark_page(size_t page) {
+		this->_dirty[page / 64] |= uint64_t{ 1 } << (page % 64);
+	}
+
+	constexpr void fault(size_t address, bool write) const {
+		if constexpr (checked) {
+			if (this->_hook) this->_hook(this->_context, address, write);
+		}
+	}
+};
+
+template<size_t Width = 128, size_t Height = 64>
+class bitplane {
+public:
+	using word_t = uint64_t;
+	static constexpr size_t width = Width;
+	static constexpr size_t height = Height;
+	static constexpr size_t word_bits = std::numeric_limits<word_t>::digits;
+	static constexpr size_t words_per_row = width / word_bits;
+
+	static_assert(width % word_bits == 0, "rows must be a whole number of words");
+
+	// Column 0 is the most significant bit of the first word.
+	using row_t = std::array<word_t, words_per_row>;
+
+	static constexpr row_t shift_right(const row_t &row, size_t count) {
+		row_t result{};
+		const size_t words = count / word_bits;
+		const size_t bits = count % word_bits;
+		for (size_t i = words; i < words_per_row; ++i) {
+			result[i] = row[i - words] >> bits;
+			if (bits && i > words) result[i] |= row[i - words - 1] << (word_bits - bits);
+		}
+		return result;
+	}
+
+	static constexpr row_t shift_left(const row_t &row, size_t count) {
+		row_t result{};
+		const size_t words = count / word_bits;
+		const size_t bits = count % word_bits;
+		for (size_t i = 0; i + words < words_per_row; ++i) {
+			result[i] = row[i + words] << bits;
+			if (bits && i + words + 1 < words_per_row) result[i] |= row[i + words + 1] >> (word_bits - bits);
+		}
+		return result;
+	}
+
+	static constexpr row_t mask(size_t columns) {
+		row_t result{};
+		for (size_t i = 0; i < words_per_row && columns > 0; ++i) {
+			const size_t bits = (columns < word_bits) ? columns : word_bits;
+			result[i] = (bits == word_bits) ? ~word_t{0} : ~(~word_t{0} >> bits);
+			columns -= bits;
 		}
+		return result;
+	}
+
+	constexpr void clear() {
+		for (auto &row : _rows) row.fill(0);
 	}
 
-	constexpr auto read(size_t index) const { return (index < size) ? _data[index] : 0; }
+	constexpr const row_t &row(size_t y) const { return _rows[y]; }
+
+	constexpr bool get(size_t x, size_t y) const {
+		return (_rows[y][x / word_bits] >> (word_bits - 1 - x % word_bits)) & 1;
+	}
+
+	// XOR a sprite row of `count` bits (MSB first) in at column x, either clipping or
+	// wrapping at `columns`. Returns true on collision.
+	constexpr bool draw(size_t x, size_t y, uint16_t bits, size_t count, size_t columns, bool clip) {
+		row_t sprite{};
+		sprite[0] = static_cast<word_t>(bits) << (word_bits - count);
+
+		const auto active = mask(columns);
+		auto placed = shift_right(sprite, x);
+		if (!clip && x + count > columns) {
+			const auto wrapped = shift_left(sprite, columns - x);
+			for (size_t i = 0; i < words_per_row; ++i) placed[i] |= wrapped[i];
+		}
+
+		bool collision = false;
+		auto &target = _rows[y];
+		for (size_t i = 0; i < words_per_row; ++i) {
+			placed[i] &= active[i];
+			collision |= (target[i] & placed[i]) != 0;
+			target[i] ^= placed[i];
+		}
+		return collision;
+	}
+
+	constexpr void scroll_down(size_t count, size_t rows) {
+		for (size_t y = rows; y-- > 0;) {
+			if (y >= count) {
+				_rows[y] = _rows[y - count];
+			} else {
+				_rows[y].fill(0);
+			}
+		}
+	}
+
+	constexpr void scroll_right(size_t count, size_t columns) {
+		const auto active = mask(columns);
+		for (auto &row : _rows) {
+			row = shift_right(row, count);
+			for (size_t i = 0; i < words_per_row; ++i) row[i] &= active[i];
+		}
+	}
+
+	constexpr void scroll_left(size_t count) {
+		for (auto &row : _rows) row = shift_left(row, count);
+	}
+
+	constexpr void scroll_up(size_t count, size_t rows) {
+		for (size_t y = 0; y < rows; ++y) {
+			if (y + count < rows) {
+				_rows[y] = _rows[y + count];
+			} else {
+				_rows[y].fill(0);
+			}
+		}
+	}
 
 private:
-	std::array<data_t, size> _data;
+	std::array<row_t, height> _rows{};
 };
 
+enum class engine {
+	switch_case,
+	table,
+	threaded,
+	cached,
+};
+
+// The threaded engine needs the GNU labels-as-values extension; elsewhere it
+// falls back to the switch dispatcher.
+#if defined(CHIP8_THREADED_DISPATCH) && defined(__GNUC__)
+#define CHIP8_HAS_THREADED_DISPATCH 1
+constexpr engine fastest_engine = engine::threaded;
+#else
+#define CHIP8_HAS_THREADED_DISPATCH 0
+constexpr engine fastest_engine = engine::switch_case;
+#endif
+
+// The table engine can use ALU and compare handlers specialised for every
+// register pair. This trades a much larger binary for immediate operands.
+#if defined(CHIP8_SPECIALIZED_OPERANDS)
+#define CHIP8_HAS_SPECIALIZED_OPERANDS 1
+#else
+#define CHIP8_HAS_SPECIALIZED_OPERANDS 0
+#endif
+
+// Benchmarks can count how many handler calls the predecoded engine makes,
+// to compare against the instructions those calls executed.
+#if defined(CHIP8_COUNT_DISPATCHES)
+#define CHIP8_HAS_DISPATCH_COUNTER 1
+#else
+#define CHIP8_HAS_DISPATCH_COUNTER 0
+#endif
+
+namespace quirks {
+
+struct cosmac_vip {
+	static constexpr const char *name = "cosmac_vip";
+	static constexpr size_t ram_size = memory<>::size;
+	using addressing = chip8::addressing::masked;
+	static constexpr bool xo_instructions = false;
+	static constexpr bool extended_display = false;
+	static constexpr bool shift_uses_vy = true;
+	static constexpr bool load_store_increments_i = true;
+	static constexpr bool jump_uses_vx = false;
+	static constexpr bool clip_sprites = true;
+	static constexpr bool logic_resets_vf = true;
+};
+
+struct schip {
+	static constexpr const char *name = "schip";
+	static constexpr size_t ram_size = memory<>::size;
+	using addressing = chip8::addressing::masked;
+	static constexpr bool xo_instructions = false;
+	static constexpr bool extended_display = true;
+	static constexpr bool shift_uses_vy = false;
+	static constexpr bool load_store_increments_i = false;
+	static constexpr bool jump_uses_vx = true;
+	static constexpr bool clip_sprites = true;
+	static constexpr bool logic_resets_vf = false;
+};
+
+struct xo_chip {
+	static constexpr const char *name = "xo_chip";
+	static constexpr size_t ram_size = 0x10000;
+	using addressing = chip8::addressing::masked;
+	static constexpr bool xo_instructions = true;
+	static constexpr bool extended_display = true;
+	static constexpr bool shift_uses_vy = true;
+	static constexpr bool load_store_increments_i = true;
+	static constexpr bool jump_uses_vx = false;
+	static constexpr bool clip_sprites = false;
+	static constexpr bool logic_resets_vf = false;
+};
+
+} // namespace quirks
+
+// The dialects a ROM can target, one per quirks policy above.
+enum class variant : size_t {
+	cosmac_vip,
+	schip,
+	xo_chip,
+};
+
+namespace detail {
+
+// Compares a path's extension with a lowercase `ext`, ignoring case.
+inline bool has_extension(const char *path, const char *ext) {
+	const char *dot = path ? std::strrchr(path, '.') : nullptr;
+	if (!dot) return false;
+
+	for (++dot; *dot && *ext; ++dot, ++ext) {
+		if (std::tolower(static_cast<unsigned char>(*dot)) != *ext) return false;
+	}
+	return *dot == *ext;
+}
+
+} // namespace detail
+
+// Picks the dialect from a ROM's file name: .sc8 is SUPER-CHIP, .xo8 is
+// XO-CHIP in any case, and anything else, or no name, is a COSMAC VIP. The
+// core and the recompiler both use this so they agree on every ROM.
+inline variant variant_from_path(const char *path) {
+	if (detail::has_extension(path, "sc8")) return variant::schip;
+	if (detail::has_extension(path, "xo8")) return variant::xo_chip;
+	return variant::cosmac_vip;
+}
+
+// Ahead-of-time translated ROMs are shared libraries exporting
+// `chip8_aot_plugin()`. A plugin only fits the exact cpu<Quirks> layout it
+// was compiled against, so the loader checks all of these fields.
+namespace aot {
+
+// Bump whenever translated code would behave differently against this
+// header, e.g. an instruction's semantics change. Member moves are caught by
+// cpu::layout_fingerprint() as well.
+constexpr uint32_t abi_version = 2;
+constexpr const char *entry_point = "chip8_aot_plugin";
+
+// Runs translated code from the current PC for at most `cycles`
+// instructions and returns how many ran; 0 means no code for this PC.
+using run_t = size_t (*)(void *cpu, size_t cycles);
+
+struct plugin {
+	uint32_t abi_version;
+	uint64_t rom_hash;
+	const char *quirks;
+	size_t cpu_size;
+	uint64_t layout;
+	run_t run;
+};
+
+using entry_t = const plugin *(*)();
+
+} // namespace aot
+
+#if defined(_WIN32)
+#define CHIP8_AOT_EXPORT extern "C" __declspec(dllexport)
+#else
+#define CHIP8_AOT_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+template<typename Quirks = quirks::cosmac_vip>
 class cpu {
 public:
-	using ram_t = memory<>;
-	using vram_t = memory<uint8_t, 64 * 32>;
+	using quirks_t = Quirks;
+
+	static constexpr size_t lores_width = 64;
+	static constexpr size_t lores_height = 32;
+	static constexpr size_t hires_width = 128;
+	static constexpr size_t hires_height = 64;
+
+	using ram_t = memory<uint8_t, quirks_t::ram_size, typename quirks_t::addressing>;
+	using vram_t = bitplane<hires_width, hires_height>;
+	static constexpr size_t num_planes = 2;
 
 	using register_t = uint8_t;
 	static constexpr size_t num_registers = 16;
 
+	enum class flag_source : uint8_t {
+		none,
+		add,
+		sub,
+		shift_right,
+		shift_left,
+	};
+
 	using index_register_t = uint16_t;
 
 	using stack_t = uint16_t;
-	using stack_index_t = size_t;
+	using stack_index_t = uint32_t;
 	static constexpr size_t max_stack = 16;
 
 	using program_counter_t = uint16_t;
@@ -81,10 +564,94 @@ public:
 
 	using timer_counter_t = uint16_t;
 
+	static constexpr size_t num_keys = static_cast<size_t>(key::key_num);
+	using keypad_t = uint16_t;
+
 	using opcode_t = uint16_t;
 	static constexpr size_t opcode_size = sizeof(opcode_t);
 
 	constexpr static size_t program_address = 0x200;
+	constexpr static size_t font_address = 0x000;
+	constexpr static size_t font_height = 5;
+	constexpr static size_t large_font_address = 0x050;
+	constexpr static size_t large_font_height = 10;
+	constexpr static size_t num_flags = 16;
+
+	static constexpr size_t pattern_size = 16;
+	using pattern_t = std::array<uint8_t, pattern_size>;
+	static constexpr register_t default_pitch = 64;
+
+	static constexpr size_t cache_line_size = 64;
+
+	using random_t = uint32_t;
+	static constexpr random_t default_seed = 0x9E3779B9;
+
+	static constexpr std::array<uint8_t, 16 * font_height> font{
+		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+		0x20, 0x60, 0x20, 0x20, 0x70, // 1
+		0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+		0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+		0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+		0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+		0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+		0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+		0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+		0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+		0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+		0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+		0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+		0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+		0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+		0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+	};
+
+	static constexpr std::array<uint8_t, 16 * large_font_height> large_font{
+		0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+		0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+		0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+		0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+		0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+		0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+		0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+		0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+		0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+		0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+		0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0, // F
+	};
+
+	cpu() {
+		static_assert(std::is_standard_layout_v<cpu>, "the hot state is located with offsetof");
+		static_assert(offsetof(cpu, _registers) == 0, "the hot state must start the object");
+		static_assert(offsetof(cpu, _plane_mask) + sizeof(_plane_mask) <= cache_line_size, "the hot state must fit one cache line");
+		static_assert(offsetof(cpu, _stack) >= cache_line_size, "cold state must not share the hot cache line");
+	}
+
+	// Hashes the ABI version with the offset of every member translated code
+	// may reach through inlined accessors, so a plugin built against another
+	// layout is refused even when sizeof(cpu) happens to match.
+	static constexpr uint64_t layout_fingerprint() {
+		const size_t layout[] = {
+			sizeof(cpu),
+			offsetof(cpu, _registers), offsetof(cpu, _program_counter), offsetof(cpu, _current_opcode),
+			offsetof(cpu, _index_register), offsetof(cpu, _stack_pointer), offsetof(cpu, _flag_source),
+			offsetof(cpu, _flag_left), offsetof(cpu, _flag_right), offsetof(cpu, _delay_timer),
+			offsetof(cpu, _sound_timer), offsetof(cpu, _keypad), offsetof(cpu, _waiting_key),
+			offsetof(cpu, _idle_skip), offsetof(cpu, _idle), offsetof(cpu, _hires),
+			offsetof(cpu, _plane_mask), offsetof(cpu, _stack), offsetof(cpu, _waiting_register),
+			offsetof(cpu, _translation), offsetof(cpu, _flags), offsetof(cpu, _pattern),
+			offsetof(cpu, _pitch), offsetof(cpu, _random), offsetof(cpu, _ram),
+			offsetof(cpu, _vram), offsetof(cpu, _page_hashes), offsetof(cpu, _vram_hash),
+			offsetof(cpu, _vram_dirty), offsetof(cpu, _cache),
+		};
+		uint64_t hash = aot::abi_version;
+		for (const size_t offset : layout) hash = detail::xxh64_merge(hash, offset);
+		return hash;
+	}
 
 	constexpr auto stack_pointer() const { return _stack_pointer; }
 	constexpr auto program_counter() const { return _program_counter; }
@@ -92,23 +659,268 @@ public:
 	constexpr auto delay_timer() const { return _delay_timer; }
 	constexpr auto sound_timer() const { return _sound_timer; }
 	constexpr bool sound() const { return sound_timer() > 0; }
+	constexpr bool waiting_key() const { return _waiting_key; }
+	constexpr const auto& pattern() const { return _pattern; }
+	constexpr auto pitch() const { return _pitch; }
+
+	constexpr bool hires() const { return _hires; }
+	constexpr size_t screen_width() const { return hires() ? hires_width : lores_width; }
+	constexpr size_t screen_height() const { return hires() ? hires_height : lores_height; }
+
+	constexpr const auto& vram(size_t plane = 0) const { return _vram[plane]; }
+	constexpr auto plane_mask() const { return _plane_mask; }
+	constexpr auto random_state() const { return _random; }
+
+	// Cxkk draws from a generator owned by this cpu and saved with its
+	// state, so runs replay exactly. reset() and load() keep the seed.
+	constexpr void seed(uint64_t value) {
+		const auto folded = static_cast<random_t>(value ^ (value >> 32));
+		_random = folded ? folded : default_seed;
+	}
 
-	constexpr const auto update_opcode() {
+	// One xorshift32 step. It has no branches and no shared state, so any
+	// number of generators can be stepped side by side.
+	static constexpr random_t next_random(random_t state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	void reset() {
+		_ram.clear();
+		for (auto &plane : _vram) plane.clear();
+		_vram_dirty = true;
+		_plane_mask = 0x1;
+		_ram.write(font.data(), font.size(), font_address);
+		_ram.write(large_font.data(), large_font.size(), large_font_address);
+		_hires = false;
+
+		_registers.fill(0);
+		_flag_source = flag_source::none;
+		_index_register = 0;
+
+		_stack.fill(0);
+		_stack_pointer = 0;
+
+		_program_counter = program_address;
 		_current_opcode = 0;
 
-		for (size_t i = 0; i << opcode_size; ++i) {
-			_current_opcode = _current_opcode << 8;
-			_current_opcode |= _ram.read(program_counter() + i);
+		_delay_timer = 0;
+		_sound_timer = 0;
+
+		_keypad = 0;
+		_waiting_key = false;
+		_waiting_register = 0;
+
+		_flags.fill(0);
+
+		_pattern.fill(0xF0);
+		_pitch = default_pitch;
+	}
+
+	void load(const uint8_t *data, size_t size) {
+		reset();
+		if (data) _ram.write(data, size, program_address);
+		invalidate();
+	}
+
+	// Architectural state only; the decode cache is rebuilt on demand.
+	template<typename Self, typename Visitor>
+	static constexpr void visit_state(Self &self, Visitor &&visitor) {
+		visitor(self._ram.storage());
+		visitor(self._vram);
+		visitor(self._plane_mask);
+		visitor(self._hires);
+		visitor(self._registers);
+		visitor(self._index_register);
+		visitor(self._stack);
+		visitor(self._stack_pointer);
+		visitor(self._program_counter);
+		visitor(self._current_opcode);
+		visitor(self._delay_timer);
+		visitor(self._sound_timer);
+		visitor(self._keypad);
+		visitor(self._waiting_key);
+		visitor(self._waiting_register);
+		visitor(self._flags);
+		visitor(self._pattern);
+		visitor(self._pitch);
+		visitor(self._random);
+	}
+
+	void serialize(uint8_t *data) {
+		materialize_vf();
+		visit_state(*this, [&](const auto &member) {
+			memcpy(data, &member, sizeof(member));
+			data += sizeof(member);
+		});
+	}
+
+	// Returns false, leaving the cpu untouched, for a state whose stack
+	// pointer or Fx0A target register would index out of range.
+	bool unserialize(const uint8_t *data) {
+		cpu restored(*this);
+		visit_state(restored, [&](auto &member) {
+			memcpy(&member, data, sizeof(member));
+			data += sizeof(member);
+		});
+		if (restored._stack_pointer > max_stack || restored._waiting_register >= num_registers) return false;
+
+		*this = restored;
+		_flag_source = flag_source::none;
+		_ram.mark_dirty();
+		_vram_dirty = true;
+		invalidate();
+		return true;
+	}
+
+	// Hash of everything serialize() writes, for spotting desyncs between
+	// runs. RAM is hashed page by page and VRAM as a whole, and only what
+	// was written since the last call is rehashed, so taking it every frame
+	// stays cheap.
+	uint64_t state_hash() {
+		materialize_vf();
+		_ram.take_dirty([&](size_t page, const uint8_t *data, size_t length) {
+			_page_hashes[page] = detail::xxh64(data, length);
+		});
+		if (_vram_dirty) {
+			_vram_hash = detail::xxh64(reinterpret_cast<const uint8_t *>(_vram.data()), sizeof(_vram));
+			_vram_dirty = false;
+		}
+
+		uint64_t hash = detail::xxh64(reinterpret_cast<const uint8_t *>(_page_hashes.data()), sizeof(_page_hashes), _vram_hash);
+		visit_state(*this, [&](const auto &member) {
+			using member_t = std::decay_t<decltype(member)>;
+			if constexpr (!std::is_same_v<member_t, typename ram_t::storage_t> && !std::is_same_v<member_t, decltype(_vram)>) {
+				hash = detail::xxh64(reinterpret_cast<const uint8_t *>(&member), sizeof(member), hash);
+			}
+		});
+		return hash;
+	}
+
+	static constexpr register_t key_value(key k) {
+		constexpr std::array<register_t, num_keys> values{
+			0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8, 0x9, 0x0, 0xA, 0xB, 0xC, 0xD, 0xE, 0xF,
+		};
+		return values[static_cast<size_t>(k)];
+	}
+
+	constexpr auto keypad() const { return _keypad; }
+	constexpr bool pressed(register_t value) const { return (_keypad >> (value & 0xF)) & 1; }
+
+	// Bit n of `state` is hex key n. A key that goes down while Fx0A waits resumes the CPU.
+	constexpr void set_keypad(keypad_t state) {
+		const keypad_t just_pressed = state & ~_keypad;
+		_keypad = state;
+
+		if (just_pressed && _waiting_key) {
+			register_t value = 0;
+			while (((just_pressed >> value) & 1) == 0) ++value;
+			reg(_waiting_register) = value;
+			_waiting_key = false;
 		}
+	}
+
+	constexpr void set_key(key k, bool pressed) {
+		const auto bit = static_cast<keypad_t>(1 << key_value(k));
+		set_keypad(pressed ? (_keypad | bit) : (_keypad & ~bit));
+	}
+
+	constexpr auto x() const { return static_cast<size_t>((current_opcode() & 0x0F00) >> 8); }
+	constexpr auto y() const { return static_cast<size_t>((current_opcode() & 0x00F0) >> 4); }
+
+	// Register operands of the ALU and compare handlers. `runtime_operand`
+	// decodes the index from the opcode; any other value is baked in.
+	static constexpr size_t runtime_operand = num_registers;
+
+	// Register access that first materialises a deferred VF flag.
+	constexpr register_t &reg(size_t index) {
+		if (index == 0xF) materialize_vf();
+		return _registers[index];
+	}
+
+	template<size_t X>
+	constexpr register_t &vx() {
+		if constexpr (X == runtime_operand) return reg(x());
+		else return reg(X);
+	}
 
+	template<size_t Y>
+	constexpr register_t &vy() {
+		if constexpr (Y == runtime_operand) return reg(y());
+		else return reg(Y);
+	}
+	constexpr auto n() const { return static_cast<size_t>(current_opcode() & 0x000F); }
+	constexpr auto kk() const { return static_cast<register_t>(current_opcode() & 0x00FF); }
+	constexpr auto nnn() const { return static_cast<program_counter_t>(current_opcode() & 0x0FFF); }
+
+	constexpr opcode_t fetch(size_t address) const {
+		opcode_t opcode = 0;
+
+		for (size_t i = 0; i < opcode_size; ++i) {
+			opcode = opcode << 8;
+			opcode |= _ram.read(address + i);
+		}
+
+		return opcode;
+	}
+
+	constexpr const auto update_opcode() {
+		_current_opcode = fetch(program_counter());
 		return _current_opcode;
 	}
 
 	void cycle() {
 		update_opcode();
+		_program_counter += increment_pc;
+
 		dispatch();
+	}
 
-		_program_counter += increment_pc;
+	size_t run(size_t cycles, engine mode = engine::switch_case) {
+		_idle = false;
+		if (_translation) return run_translated(cycles, mode);
+		return run_engine(cycles, mode);
+	}
+
+	constexpr bool idle() const { return _idle; }
+	constexpr void set_idle_skip(bool enabled) { _idle_skip = enabled; }
+
+	// Only for quirks with checked addressing.
+	void set_fault_hook(fault_hook_t hook, void *context) { _ram.set_fault_hook(hook, context); }
+
+	void set_translation(aot::run_t translation) { _translation = translation; }
+
+#if CHIP8_HAS_DISPATCH_COUNTER
+	// Handler calls made by the predecoded engine since the cpu was created.
+	constexpr size_t dispatches() const { return _cache.dispatches; }
+#endif
+
+	// Translated code calls this before each instruction's handler in place
+	// of the fetch the interpreter does.
+	constexpr void enter(program_counter_t address, opcode_t opcode) {
+		_program_counter = static_cast<program_counter_t>(address + increment_pc);
+		_current_opcode = opcode;
+	}
+
+	constexpr bool stopped() const { return _waiting_key || _idle; }
+
+	size_t run_engine(size_t cycles, engine mode) {
+		switch (mode) {
+		case engine::switch_case: return run_with<&cpu::dispatch>(cycles);
+		case engine::table: return run_with<&cpu::dispatch_table>(cycles);
+#if CHIP8_HAS_THREADED_DISPATCH
+		case engine::threaded: return run_threaded(cycles);
+#else
+		case engine::threaded: return run_with<&cpu::dispatch>(cycles);
+#endif
+		case engine::cached: return run_cached(cycles);
+		}
+		return 0;
+	}
+
+	constexpr void update_timers() {
 		if (_delay_timer > 0) --_delay_timer;
 		if (_sound_timer > 0) --_sound_timer;
 	}
@@ -123,7 +935,17 @@ public:
 		case 0x2000: op_2nnn(); break;
 		case 0x3000: op_3xkk(); break;
 		case 0x4000: op_4xkk(); break;
-		case 0x5000: op_5xy0(); break;
+		case 0x5000:
+		{
+			const auto sub_inst = opcode & 0x000F;
+			switch (sub_inst) {
+			case 0x0000: op_5xy0(); break;
+			case 0x0002: op_5xy2(); break;
+			case 0x0003: op_5xy3(); break;
+			default: op_error(); break;
+			}
+			break;
+		}
 		case 0x6000: op_6xkk(); break;
 		case 0x7000: op_7xkk(); break;
 		case 0x8000:
@@ -162,6 +984,9 @@ public:
 		{
 			const auto sub_inst = opcode & 0x00FF;
 			switch (sub_inst) {
+			case 0x0000: op_F000(); break;
+			case 0x0001: op_Fn01(); break;
+			case 0x0002: op_F002(); break;
 			case 0x0007: op_Fx07(); break;
 			case 0x000A: op_Fx0A(); break;
 			case 0x0015: op_Fx15(); break;
@@ -169,8 +994,12 @@ public:
 			case 0x001E: op_Fx1E(); break;
 			case 0x0029: op_Fx29(); break;
 			case 0x0033: op_Fx33(); break;
+			case 0x003A: op_Fx3A(); break;
 			case 0x0055: op_Fx55(); break;
 			case 0x0065: op_Fx65(); break;
+			case 0x0030: op_Fx30(); break;
+			case 0x0075: op_Fx75(); break;
+			case 0x0085: op_Fx85(); break;
 			default: op_error(); break;
 			}
 			break;
@@ -178,136 +1007,482 @@ public:
 		}
 	}
 
+	using handler_t = void (cpu::*)();
+
+	void dispatch_table() {
+		static constexpr std::array<handler_t, 16> table{
+			&cpu::op_0nnn, &cpu::op_1nnn, &cpu::op_2nnn, &cpu::op_3xkk,
+			&cpu::op_4xkk, &cpu::dispatch_5, &cpu::op_6xkk, &cpu::op_7xkk,
+			&cpu::dispatch_8, &cpu::dispatch_9, &cpu::op_Annn, &cpu::op_Bnnn,
+			&cpu::op_Cxkk, &cpu::op_Dxyn, &cpu::dispatch_E, &cpu::dispatch_F,
+		};
+		(this->*table[current_opcode() >> 12])();
+	}
+
+	void dispatch_5() {
+#if CHIP8_HAS_SPECIALIZED_OPERANDS
+		if ((current_opcode() & 0x000F) == 0x0) {
+			static constexpr auto operands = make_operand_table<&cpu::compare_handler<true>>(std::make_index_sequence<256>());
+			(this->*operands[(current_opcode() & 0x0FF0) >> 4])();
+			return;
+		}
+#endif
+		static constexpr auto table = [] {
+			std::array<handler_t, 16> t{};
+			for (auto &handler : t) handler = &cpu::op_error;
+			t[0x0] = &cpu::op_5xy0<>;
+			t[0x2] = &cpu::op_5xy2;
+			t[0x3] = &cpu::op_5xy3;
+			return t;
+		}();
+		(this->*table[current_opcode() & 0x000F])();
+	}
+
+	void dispatch_8() {
+#if CHIP8_HAS_SPECIALIZED_OPERANDS
+		static constexpr auto operands = make_operand_table<&cpu::alu_handler>(std::make_index_sequence<4096>());
+		(this->*operands[current_opcode() & 0x0FFF])();
+#else
+		static constexpr auto table = [] {
+			std::array<handler_t, 16> t{};
+			for (auto &handler : t) handler = &cpu::op_error;
+			t[0x0] = &cpu::op_8xy0<>;
+			t[0x1] = &cpu::op_8xy1<>;
+			t[0x2] = &cpu::op_8xy2<>;
+			t[0x3] = &cpu::op_8xy3<>;
+			t[0x4] = &cpu::op_8xy4<>;
+			t[0x5] = &cpu::op_8xy5<>;
+			t[0x6] = &cpu::op_8xy6<>;
+			t[0x7] = &cpu::op_8xy7<>;
+			t[0xE] = &cpu::op_8xyE<>;
+			return t;
+		}();
+		(this->*table[current_opcode() & 0x000F])();
+#endif
+	}
+
+	void dispatch_9() {
+#if CHIP8_HAS_SPECIALIZED_OPERANDS
+		static constexpr auto operands = make_operand_table<&cpu::compare_handler<false>>(std::make_index_sequence<256>());
+		(this->*operands[(current_opcode() & 0x0FF0) >> 4])();
+#else
+		op_9xy0();
+#endif
+	}
+
+#if CHIP8_HAS_SPECIALIZED_OPERANDS
+	// Tables of handlers with the register operands as template arguments,
+	// indexed by the low opcode bits (`xyn` for 8xyn, `xy` for 5xy0/9xy0).
+	template<handler_t (*Handler)(size_t), size_t... I>
+	static constexpr std::array<handler_t, sizeof...(I)> make_operand_table(std::index_sequence<I...>) {
+		return { Handler(I)... };
+	}
+
+	template<size_t X, size_t Y>
+	static constexpr handler_t alu_handler_for(size_t n) {
+		switch (n) {
+		case 0x0: return &cpu::op_8xy0<X, Y>;
+		case 0x1: return &cpu::op_8xy1<X, Y>;
+		case 0x2: return &cpu::op_8xy2<X, Y>;
+		case 0x3: return &cpu::op_8xy3<X, Y>;
+		case 0x4: return &cpu::op_8xy4<X, Y>;
+		case 0x5: return &cpu::op_8xy5<X, Y>;
+		case 0x6: return &cpu::op_8xy6<X, Y>;
+		case 0x7: return &cpu::op_8xy7<X, Y>;
+		case 0xE: return &cpu::op_8xyE<X, Y>;
+		default: return &cpu::op_error;
+		}
+	}
+
+	template<size_t... XY>
+	static constexpr handler_t alu_handler_at(size_t index, std::index_sequence<XY...>) {
+		constexpr handler_t (*handlers[])(size_t) = { &cpu::alu_handler_for<(XY >> 4), (XY & 0xF)>... };
+		return handlers[index >> 4](index & 0xF);
+	}
+
+	static constexpr handler_t alu_handler(size_t index) {
+		return alu_handler_at(index, std::make_index_sequence<256>());
+	}
+
+	template<size_t... XY>
+	static constexpr handler_t compare_handler_at(bool equal, size_t index, std::index_sequence<XY...>) {
+		constexpr handler_t equal_handlers[] = { &cpu::op_5xy0<(XY >> 4), (XY & 0xF)>... };
+		constexpr handler_t unequal_handlers[] = { &cpu::op_9xy0<(XY >> 4), (XY & 0xF)>... };
+		return equal ? equal_handlers[index] : unequal_handlers[index];
+	}
+
+	template<bool Equal>
+	static constexpr handler_t compare_handler(size_t index) {
+		return compare_handler_at(Equal, index, std::make_index_sequence<256>());
+	}
+#endif
+
+	void dispatch_E() {
+		switch (current_opcode() & 0x00FF) {
+		case 0x009E: op_Ex9E(); break;
+		case 0x00A1: op_ExA1(); break;
+		default: op_error(); break;
+		}
+	}
+
+	void dispatch_F() {
+		static constexpr auto table = [] {
+			std::array<handler_t, 256> t{};
+			for (auto &handler : t) handler = &cpu::op_error;
+			t[0x00] = &cpu::op_F000;
+			t[0x01] = &cpu::op_Fn01;
+			t[0x02] = &cpu::op_F002;
+			t[0x07] = &cpu::op_Fx07;
+			t[0x0A] = &cpu::op_Fx0A;
+			t[0x15] = &cpu::op_Fx15;
+			t[0x18] = &cpu::op_Fx18;
+			t[0x1E] = &cpu::op_Fx1E;
+			t[0x29] = &cpu::op_Fx29;
+			t[0x30] = &cpu::op_Fx30;
+			t[0x33] = &cpu::op_Fx33;
+			t[0x3A] = &cpu::op_Fx3A;
+			t[0x55] = &cpu::op_Fx55;
+			t[0x65] = &cpu::op_Fx65;
+			t[0x75] = &cpu::op_Fx75;
+			t[0x85] = &cpu::op_Fx85;
+			return t;
+		}();
+		(this->*table[current_opcode() & 0x00FF])();
+	}
+
 	void op_0nnn() {
+		switch (current_opcode()) {
+		case 0x00E0: op_00E0(); break;
+		case 0x00EE: op_00EE(); break;
+		case 0x00FB: op_00FB(); break;
+		case 0x00FC: op_00FC(); break;
+		case 0x00FD: op_00FD(); break;
+		case 0x00FE: op_00FE(); break;
+		case 0x00FF: op_00FF(); break;
+		default:
+			if ((current_opcode() & 0xFFF0) == 0x00C0) op_00Cn();
+			if ((current_opcode() & 0xFFF0) == 0x00D0) op_00Dn();
+			break;
+		}
+	}
 
+	void op_00Cn() {
+		if constexpr (quirks_t::extended_display) {
+			for_each_plane([&](vram_t &plane) { plane.scroll_down(n(), screen_height()); });
+		}
 	}
 
-	void op_1nnn() {
+	void op_00Dn() {
+		if constexpr (quirks_t::xo_instructions) {
+			for_each_plane([&](vram_t &plane) { plane.scroll_up(n(), screen_height()); });
+		}
+	}
+
+	void op_00FB() {
+		if constexpr (quirks_t::extended_display) {
+			for_each_plane([&](vram_t &plane) { plane.scroll_right(4, screen_width()); });
+		}
+	}
+
+	void op_00FC() {
+		if constexpr (quirks_t::extended_display) {
+			for_each_plane([](vram_t &plane) { plane.scroll_left(4); });
+		}
+	}
 
+	void op_00FD() {
+		if constexpr (quirks_t::extended_display) _program_counter -= increment_pc;
+	}
+
+	void op_00FE() {
+		if constexpr (quirks_t::extended_display) {
+			_hires = false;
+			for (auto &plane : _vram) plane.clear();
+			_vram_dirty = true;
+		}
+	}
+
+	void op_00FF() {
+		if constexpr (quirks_t::extended_display) {
+			_hires = true;
+			for (auto &plane : _vram) plane.clear();
+			_vram_dirty = true;
+		}
+	}
+
+	void op_00E0() {
+		for_each_plane([](vram_t &plane) { plane.clear(); });
+	}
+
+	void op_00EE() {
+		if (_stack_pointer == 0) {
+			op_error();
+
+		} else {
+			_program_counter = _stack[--_stack_pointer];
+		}
+	}
+
+	void op_1nnn() {
+		if (_idle_skip) detect_idle();
+		_program_counter = nnn();
 	}
 
 	void op_2nnn() {
+		if (_stack_pointer >= max_stack) {
+			op_error();
 
+		} else {
+			_stack[_stack_pointer++] = _program_counter;
+			_program_counter = nnn();
+		}
 	}
 
 	void op_3xkk() {
-
+		if (reg(x()) == kk()) skip();
 	}
 
 	void op_4xkk() {
-
+		if (reg(x()) != kk()) skip();
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_5xy0() {
+		if (vx<X>() == vy<Y>()) skip();
+	}
 
+	void op_5xy2() {
+		if constexpr (quirks_t::xo_instructions) {
+			const size_t count = (x() > y()) ? x() - y() : y() - x();
+			const int step = (x() > y()) ? -1 : 1;
+			for (size_t i = 0; i <= count; ++i) {
+				store(reg(x() + step * static_cast<int>(i)), _index_register + i);
+			}
+		}
 	}
 
-	void op_6xkk() {
+	void op_5xy3() {
+		if constexpr (quirks_t::xo_instructions) {
+			const size_t count = (x() > y()) ? x() - y() : y() - x();
+			const int step = (x() > y()) ? -1 : 1;
+			for (size_t i = 0; i <= count; ++i) {
+				reg(x() + step * static_cast<int>(i)) = _ram.read(_index_register + i);
+			}
+		}
+	}
 
+	void op_6xkk() {
+		reg(x()) = kk();
 	}
 
 	void op_7xkk() {
-
+		reg(x()) += kk();
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_8xy0() {
-
+		vx<X>() = vy<Y>();
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_8xy1() {
-
+		vx<X>() |= vy<Y>();
+		if constexpr (quirks_t::logic_resets_vf) set_vf(0);
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_8xy2() {
-
+		vx<X>() &= vy<Y>();
+		if constexpr (quirks_t::logic_resets_vf) set_vf(0);
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_8xy3() {
-
+		vx<X>() ^= vy<Y>();
+		if constexpr (quirks_t::logic_resets_vf) set_vf(0);
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_8xy4() {
-
+		const auto left = vx<X>();
+		const auto right = vy<Y>();
+		vx<X>() = left + right;
+		defer_vf(flag_source::add, left, right);
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_8xy5() {
-
+		const auto left = vx<X>();
+		const auto right = vy<Y>();
+		vx<X>() = left - right;
+		defer_vf(flag_source::sub, left, right);
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_8xy6() {
-
+		const auto source = quirks_t::shift_uses_vy ? vy<Y>() : vx<X>();
+		vx<X>() = source >> 1;
+		defer_vf(flag_source::shift_right, source);
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_8xy7() {
-
+		const auto left = vx<X>();
+		const auto right = vy<Y>();
+		vx<X>() = right - left;
+		defer_vf(flag_source::sub, right, left);
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_8xyE() {
-
+		const auto source = quirks_t::shift_uses_vy ? vy<Y>() : vx<X>();
+		vx<X>() = source << 1;
+		defer_vf(flag_source::shift_left, source);
 	}
 
+	template<size_t X = runtime_operand, size_t Y = runtime_operand>
 	void op_9xy0() {
-
+		if (vx<X>() != vy<Y>()) skip();
 	}
 
 	void op_Annn() {
-
+		_index_register = nnn();
 	}
 
 	void op_Bnnn() {
-
+		const auto offset = reg(quirks_t::jump_uses_vx ? x() : 0);
+		_program_counter = nnn() + offset;
 	}
 
 	void op_Cxkk() {
-
+		_random = next_random(_random);
+		reg(x()) = static_cast<register_t>(_random >> 24) & kk();
 	}
 
 	void op_Dxyn() {
-
+		const size_t columns = screen_width();
+		const size_t rows = screen_height();
+		const size_t left = reg(x()) % columns;
+		const size_t top = reg(y()) % rows;
+
+		const bool large = (n() == 0) && quirks_t::extended_display;
+		const size_t height = large ? 16 : n();
+		const size_t width = large ? 16 : 8;
+		const size_t pitch = large ? 2 : 1;
+
+		bool collision = false;
+		size_t address = _index_register;
+		for (size_t plane = 0; plane < num_planes; ++plane) {
+			if ((_plane_mask & (1 << plane)) == 0) continue;
+
+			for (size_t row = 0; row < height; ++row, address += pitch) {
+				size_t py = top + row;
+				if (py >= rows) {
+					if constexpr (quirks_t::clip_sprites) continue;
+					py %= rows;
+				}
+
+				uint16_t bits = _ram.read(address);
+				if (large) bits = static_cast<uint16_t>((bits << 8) | _ram.read(address + 1));
+
+				collision |= _vram[plane].draw(left, py, bits, width, columns, quirks_t::clip_sprites);
+			}
+		}
+		_vram_dirty = true;
+		set_vf(collision ? 1 : 0);
 	}
 
 	void op_Ex9E() {
-
+		if (pressed(reg(x()))) skip();
 	}
 
 	void op_ExA1() {
+		if (!pressed(reg(x()))) skip();
+	}
 
+	void op_F000() {
+		if constexpr (quirks_t::xo_instructions) {
+			_index_register = fetch(_program_counter);
+			_program_counter += increment_pc;
+		}
 	}
 
-	void op_Fx07() {
+	void op_Fn01() {
+		if constexpr (quirks_t::xo_instructions) _plane_mask = x() & 0x3;
+	}
 
+	void op_F002() {
+		if constexpr (quirks_t::xo_instructions) {
+			for (size_t i = 0; i < pattern_size; ++i) {
+				_pattern[i] = _ram.read(_index_register + i);
+			}
+		}
 	}
 
-	void op_Fx0A() {
+	void op_Fx07() {
+		reg(x()) = static_cast<register_t>(_delay_timer);
+	}
 
+	void op_Fx0A() {
+		_waiting_register = x();
+		_waiting_key = true;
 	}
 
 	void op_Fx15() {
-
+		_delay_timer = reg(x());
 	}
 
 	void op_Fx18() {
-
+		_sound_timer = reg(x());
 	}
 
 	void op_Fx1E() {
-
+		_index_register += reg(x());
 	}
 
 	void op_Fx29() {
+		_index_register = font_address + (reg(x()) & 0xF) * font_height;
+	}
 
+	void op_Fx30() {
+		_index_register = large_font_address + (reg(x()) & 0xF) * large_font_height;
 	}
 
 	void op_Fx33() {
+		const auto value = reg(x());
+		store(value / 100, _index_register);
+		store((value / 10) % 10, _index_register + 1);
+		store(value % 10, _index_register + 2);
+	}
 
+	void op_Fx3A() {
+		if constexpr (quirks_t::xo_instructions) _pitch = reg(x());
 	}
 
 	void op_Fx55() {
-
+		for (size_t i = 0; i <= x(); ++i) {
+			store(reg(i), _index_register + i);
+		}
+		if constexpr (quirks_t::load_store_increments_i) _index_register += x() + 1;
 	}
 
 	void op_Fx65() {
+		for (size_t i = 0; i <= x(); ++i) {
+			reg(i) = _ram.read(_index_register + i);
+		}
+		if constexpr (quirks_t::load_store_increments_i) _index_register += x() + 1;
+	}
 
+	void op_Fx75() {
+		for (size_t i = 0; i <= x() && i < num_flags; ++i) {
+			_flags[i] = reg(i);
+		}
+	}
+
+	void op_Fx85() {
+		for (size_t i = 0; i <= x() && i < num_flags; ++i) {
+			reg(i) = _flags[i];
+		}
 	}
 
 	void op_error() {
@@ -315,20 +1490,428 @@ public:
 	}
 
 private:
-	ram_t _ram;
-	vram_t _vram;
+	template<void (cpu::*Dispatch)()>
+	size_t run_with(size_t cycles) {
+		size_t executed = 0;
+		while (executed < cycles && !_waiting_key && !_idle) {
+			update_opcode();
+			_program_counter += increment_pc;
+			(this->*Dispatch)();
+			++executed;
+		}
+		return executed;
+	}
 
-	std::array<register_t, num_registers> _registers;
-	index_register_t _index_register;
+#if CHIP8_HAS_THREADED_DISPATCH
+	// Every handler ends in its own fetch and indirect jump instead of
+	// returning to a shared dispatch point.
+	size_t run_threaded(size_t cycles) {
+		static void *const labels[16] = {
+			&&label_0, &&label_1, &&label_2, &&label_3, &&label_4, &&label_5, &&label_6, &&label_7,
+			&&label_8, &&label_9, &&label_A, &&label_B, &&label_C, &&label_D, &&label_E, &&label_F,
+		};
+		static void *const labels_8[16] = {
+			&&label_8xy0, &&label_8xy1, &&label_8xy2, &&label_8xy3, &&label_8xy4, &&label_8xy5, &&label_8xy6, &&label_8xy7,
+			&&label_error, &&label_error, &&label_error, &&label_error, &&label_error, &&label_error, &&label_8xyE, &&label_error,
+		};
+
+		size_t executed = 0;
+
+#define CHIP8_DISPATCH_NEXT() \
+		do { \
+			if (executed >= cycles || _waiting_key || _idle) return executed; \
+			update_opcode(); \
+			_program_counter += increment_pc; \
+			++executed; \
+			goto *labels[_current_opcode >> 12]; \
+		} while (false)
+
+		CHIP8_DISPATCH_NEXT();
+
+	label_0: op_0nnn(); CHIP8_DISPATCH_NEXT();
+	label_1: op_1nnn(); CHIP8_DISPATCH_NEXT();
+	label_2: op_2nnn(); CHIP8_DISPATCH_NEXT();
+	label_3: op_3xkk(); CHIP8_DISPATCH_NEXT();
+	label_4: op_4xkk(); CHIP8_DISPATCH_NEXT();
+	label_5: dispatch_5(); CHIP8_DISPATCH_NEXT();
+	label_6: op_6xkk(); CHIP8_DISPATCH_NEXT();
+	label_7: op_7xkk(); CHIP8_DISPATCH_NEXT();
+	label_8: goto *labels_8[_current_opcode & 0x000F];
+	label_8xy0: op_8xy0(); CHIP8_DISPATCH_NEXT();
+	label_8xy1: op_8xy1(); CHIP8_DISPATCH_NEXT();
+	label_8xy2: op_8xy2(); CHIP8_DISPATCH_NEXT();
+	label_8xy3: op_8xy3(); CHIP8_DISPATCH_NEXT();
+	label_8xy4: op_8xy4(); CHIP8_DISPATCH_NEXT();
+	label_8xy5: op_8xy5(); CHIP8_DISPATCH_NEXT();
+	label_8xy6: op_8xy6(); CHIP8_DISPATCH_NEXT();
+	label_8xy7: op_8xy7(); CHIP8_DISPATCH_NEXT();
+	label_8xyE: op_8xyE(); CHIP8_DISPATCH_NEXT();
+	label_9: op_9xy0(); CHIP8_DISPATCH_NEXT();
+	label_A: op_Annn(); CHIP8_DISPATCH_NEXT();
+	label_B: op_Bnnn(); CHIP8_DISPATCH_NEXT();
+	label_C: op_Cxkk(); CHIP8_DISPATCH_NEXT();
+	label_D: op_Dxyn(); CHIP8_DISPATCH_NEXT();
+	label_E: dispatch_E(); CHIP8_DISPATCH_NEXT();
+	label_F: dispatch_F(); CHIP8_DISPATCH_NEXT();
+	label_error: op_error(); CHIP8_DISPATCH_NEXT();
+
+#undef CHIP8_DISPATCH_NEXT
+	}
+#endif
+
+	// Translated code stops at addresses it has no code for; each of those
+	// instructions is interpreted before trying the translation again.
+	size_t run_translated(size_t cycles, engine mode) {
+		size_t executed = 0;
+		while (executed < cycles && !stopped()) {
+			const size_t translated = _translation(this, cycles - executed);
+			executed += translated;
+			if (translated == 0) executed += run_engine(1, mode);
+		}
+		return executed;
+	}
 
-	std::array<stack_t, max_stack> _stack;
-	stack_index_t _stack_pointer;
+	// Predecoded instruction cache, one entry per RAM address. Common opcode
+	// sequences are fused into one entry; a jump into the middle of a fused
+	// sequence simply uses the entry decoded at that address.
+	struct decoded;
+	using decoded_handler_t = size_t (*)(cpu &, const decoded &);
+
+	static constexpr size_t max_fused = 3;
+
+	// How control leaves an entry: always to the same place (`direct`), by a
+	// call or return, or somewhere only known after running it.
+	enum class exit_kind : uint8_t {
+		dynamic,
+		direct,
+		call,
+		ret,
+	};
+
+	struct decoded {
+		decoded_handler_t handler = nullptr;
+		std::array<opcode_t, max_fused> opcodes{};
+		uint8_t count = 0;
+		exit_kind exit = exit_kind::dynamic;
+		decoded *next = nullptr;
+	};
+
+	// Entries link to each other by pointer, so a copied CPU starts with an
+	// empty cache rather than links into the original.
+	struct decode_cache {
+		std::vector<decoded> entries;
+		std::array<decoded *, max_stack> return_links{};
+#if CHIP8_HAS_DISPATCH_COUNTER
+		size_t dispatches = 0;
+#endif
+
+		decode_cache() = default;
+		decode_cache(const decode_cache &) {}
+		decode_cache(decode_cache &&) = default;
+		decode_cache &operator=(const decode_cache &) {
+			entries.clear();
+			return_links.fill(nullptr);
+			return *this;
+		}
+		decode_cache &operator=(decode_cache &&) = default;
+	};
+
+	template<void (cpu::*Op)()>
+	static size_t execute_single(cpu &self, const decoded &entry) {
+		self._current_opcode = entry.opcodes[0];
+		self._program_counter += increment_pc;
+		(self.*Op)();
+		return 1;
+	}
+
+	// Runs the fused instructions in order and stops early if one of them
+	// leaves the fall-through path (a taken skip).
+	template<void (cpu::*... Ops)()>
+	static size_t execute_fused(cpu &self, const decoded &entry) {
+		size_t executed = 0;
+		bool sequential = true;
+		auto step = [&](auto op) {
+			if (!sequential) return;
+			const auto next = static_cast<program_counter_t>(self._program_counter + increment_pc);
+			self._current_opcode = entry.opcodes[executed++];
+			self._program_counter = next;
+			(self.*op)();
+			sequential = self._program_counter == next;
+		};
+		(step(Ops), ...);
+		return executed;
+	}
 
+	static decoded_handler_t decode_single(opcode_t opcode) {
+		switch (opcode & 0xF000) {
+		case 0x0000: return &execute_single<&cpu::op_0nnn>;
+		case 0x1000: return &execute_single<&cpu::op_1nnn>;
+		case 0x2000: return &execute_single<&cpu::op_2nnn>;
+		case 0x3000: return &execute_single<&cpu::op_3xkk>;
+		case 0x4000: return &execute_single<&cpu::op_4xkk>;
+		case 0x5000: return &execute_single<&cpu::dispatch_5>;
+		case 0x6000: return &execute_single<&cpu::op_6xkk>;
+		case 0x7000: return &execute_single<&cpu::op_7xkk>;
+		case 0x8000:
+			switch (opcode & 0x000F) {
+			case 0x0000: return &execute_single<&cpu::op_8xy0<>>;
+			case 0x0001: return &execute_single<&cpu::op_8xy1<>>;
+			case 0x0002: return &execute_single<&cpu::op_8xy2<>>;
+			case 0x0003: return &execute_single<&cpu::op_8xy3<>>;
+			case 0x0004: return &execute_single<&cpu::op_8xy4<>>;
+			case 0x0005: return &execute_single<&cpu::op_8xy5<>>;
+			case 0x0006: return &execute_single<&cpu::op_8xy6<>>;
+			case 0x0007: return &execute_single<&cpu::op_8xy7<>>;
+			case 0x000E: return &execute_single<&cpu::op_8xyE<>>;
+			default: return &execute_single<&cpu::op_error>;
+			}
+		case 0x9000: return &execute_single<&cpu::op_9xy0<>>;
+		case 0xA000: return &execute_single<&cpu::op_Annn>;
+		case 0xB000: return &execute_single<&cpu::op_Bnnn>;
+		case 0xC000: return &execute_single<&cpu::op_Cxkk>;
+		case 0xD000: return &execute_single<&cpu::op_Dxyn>;
+		case 0xE000: return &execute_single<&cpu::dispatch_E>;
+		default: return &execute_single<&cpu::dispatch_F>;
+		}
+	}
+
+	void decode(size_t address) {
+		auto &entry = _cache.entries[address];
+		for (size_t i = 0; i < max_fused; ++i) {
+			entry.opcodes[i] = fetch(address + i * opcode_size);
+		}
+
+		const auto first = entry.opcodes[0];
+		const auto second = entry.opcodes[1];
+		const auto third = entry.opcodes[2];
+
+		if ((first & 0xF000) == 0x7000 && (second & 0xF000) == 0x3000 && (third & 0xF000) == 0x1000) {
+			entry.handler = &execute_fused<&cpu::op_7xkk, &cpu::op_3xkk, &cpu::op_1nnn>;
+			entry.count = 3;
+		} else if ((first & 0xF000) == 0xA000 && (second & 0xF000) == 0xD000) {
+			entry.handler = &execute_fused<&cpu::op_Annn, &cpu::op_Dxyn>;
+			entry.count = 2;
+		} else if ((first & 0xF000) == 0x6000 && (second & 0xF000) == 0x6000) {
+			entry.handler = &execute_fused<&cpu::op_6xkk, &cpu::op_6xkk>;
+			entry.count = 2;
+		} else if ((first & 0xF0FF) == 0xF007 && (second & 0xF0FF) == (0x3000 | (first & 0x0F00))) {
+			entry.handler = &execute_fused<&cpu::op_Fx07, &cpu::op_3xkk>;
+			entry.count = 2;
+		} else {
+			entry.handler = decode_single(first);
+			entry.count = 1;
+		}
+
+		// A fused sequence only has a fixed exit if every instruction before
+		// the last one falls through.
+		entry.exit = exit_of(entry.opcodes[entry.count - 1]);
+		for (size_t i = 0; i + 1 < entry.count; ++i) {
+			if (exit_of(entry.opcodes[i]) != exit_kind::direct) entry.exit = exit_kind::dynamic;
+		}
+		entry.next = nullptr;
+	}
+
+	static constexpr exit_kind exit_of(opcode_t opcode) {
+		switch (opcode & 0xF000) {
+		case 0x0000: return (opcode == 0x00EE) ? exit_kind::ret : exit_kind::dynamic;
+		case 0x1000:
+		case 0x6000:
+		case 0x7000:
+		case 0x8000:
+		case 0xA000:
+		case 0xC000:
+		case 0xD000:
+		case 0xF000: return exit_kind::direct;
+		case 0x2000: return exit_kind::call;
+		default: return exit_kind::dynamic;
+		}
+	}
+
+	// The entry to run after `entry`, from its link where one is known.
+	// Links are created on first use; `nullptr` falls back to a lookup.
+	decoded *successor(decoded &entry) {
+		switch (entry.exit) {
+		case exit_kind::direct:
+			if (!entry.next && _program_counter < _cache.entries.size()) entry.next = &_cache.entries[_program_counter];
+			return entry.next;
+
+		case exit_kind::call: {
+			const auto target = static_cast<program_counter_t>(entry.opcodes[entry.count - 1] & 0x0FFF);
+			if (_program_counter != target) return nullptr;
+
+			const auto resume = static_cast<size_t>(&entry - _cache.entries.data()) + entry.count * opcode_size;
+			_cache.return_links[_stack_pointer - 1] = (resume < _cache.entries.size()) ? &_cache.entries[resume] : nullptr;
+			if (!entry.next) entry.next = &_cache.entries[target];
+			return entry.next;
+		}
+
+		case exit_kind::ret: {
+			// Predicted from the matching call; a program that rewrote its
+			// stack lands somewhere else and takes the lookup.
+			const auto predicted = _cache.return_links[_stack_pointer];
+			if (predicted && static_cast<size_t>(predicted - _cache.entries.data()) == _program_counter) return predicted;
+			return nullptr;
+		}
+
+		default:
+			return nullptr;
+		}
+	}
+
+	size_t run_cached(size_t cycles) {
+		if (_cache.entries.size() != ram_t::size) _cache.entries.assign(ram_t::size, decoded{});
+
+		size_t executed = 0;
+		decoded *entry = nullptr;
+		while (executed < cycles && !_waiting_key && !_idle) {
+			if (!entry) {
+				if (_program_counter >= _cache.entries.size()) {
+					update_opcode();
+					_program_counter += increment_pc;
+					dispatch();
+					++executed;
+#if CHIP8_HAS_DISPATCH_COUNTER
+					++_cache.dispatches;
+#endif
+					continue;
+				}
+				entry = &_cache.entries[_program_counter];
+			}
+
+			if (!entry->handler) decode(static_cast<size_t>(entry - _cache.entries.data()));
+#if CHIP8_HAS_DISPATCH_COUNTER
+			++_cache.dispatches;
+#endif
+
+			if (entry->count <= cycles - executed) {
+				executed += entry->handler(*this, *entry);
+				entry = successor(*entry);
+			} else {
+				executed += decode_single(entry->opcodes[0])(*this, *entry);
+				entry = nullptr;
+			}
+		}
+		return executed;
+	}
+
+	void invalidate() {
+		_cache.entries.clear();
+		_cache.return_links.fill(nullptr);
+	}
+
+	// Any entry whose instructions cover `address` is stale after a write.
+	// Links name entries by address, so a link into a stale entry stays
+	// valid and just finds it waiting to be decoded again; only the stale
+	// entry's own outgoing link is cut.
+	void store(uint8_t value, size_t address) {
+		_ram.write(value, address);
+
+		// Entries just below the top of masked memory wrap into the bottom.
+		constexpr size_t span = max_fused * opcode_size;
+		const size_t target = ram_t::locate(address);
+		if (target >= _cache.entries.size()) return;
+		for (size_t back = 0; back < span && (ram_t::wraps || back <= target); ++back) {
+			auto &entry = _cache.entries[(target + ram_t::size - back) % ram_t::size];
+			entry.handler = nullptr;
+			entry.next = nullptr;
+		}
+	}
+
+	// 8xy4-8xyE record the operands behind VF instead of computing it; the
+	// flag is materialised only when VF is accessed or the state is saved.
+	constexpr void defer_vf(flag_source source, register_t left, register_t right = 0) {
+		_flag_source = source;
+		_flag_left = left;
+		_flag_right = right;
+	}
+
+	constexpr void set_vf(register_t value) {
+		_flag_source = flag_source::none;
+		_registers[0xF] = value;
+	}
+
+	constexpr void materialize_vf() {
+		switch (_flag_source) {
+		case flag_source::none: return;
+		case flag_source::add: _registers[0xF] = (_flag_left + _flag_right > 0xFF) ? 1 : 0; break;
+		case flag_source::sub: _registers[0xF] = (_flag_left >= _flag_right) ? 1 : 0; break;
+		case flag_source::shift_right: _registers[0xF] = _flag_left & 0x1; break;
+		case flag_source::shift_left: _registers[0xF] = (_flag_left >> 7) & 0x1; break;
+		}
+		_flag_source = flag_source::none;
+	}
+
+	// A jump to itself, or a `Fx07; 3x00; jump back` delay-timer poll while the
+	// timer is still running, can make no progress until the next timer tick.
+	constexpr void detect_idle() {
+		const auto self = _program_counter - increment_pc;
+		if (nnn() == self) {
+			_idle = true;
+
+		} else if (nnn() + 2 * increment_pc == self && _delay_timer > 0) {
+			const auto load = fetch(nnn());
+			const auto test = fetch(nnn() + increment_pc);
+			_idle = (load & 0xF0FF) == 0xF007 && (test & 0xF0FF) == 0x3000 && (load & 0x0F00) == (test & 0x0F00);
+		}
+	}
+
+	constexpr void skip() {
+		if constexpr (quirks_t::xo_instructions) {
+			if (fetch(_program_counter) == 0xF000) _program_counter += increment_pc;
+		}
+		_program_counter += increment_pc;
+	}
+
+	template<typename Function>
+	constexpr void for_each_plane(Function function) {
+		for (size_t plane = 0; plane < num_planes; ++plane) {
+			if (_plane_mask & (1 << plane)) function(_vram[plane]);
+		}
+		_vram_dirty = true;
+	}
+
+	// Hot: everything run() and the dispatch loop may touch on every
+	// instruction, in the first cache line (see the constructor).
+	alignas(cache_line_size) std::array<register_t, num_registers> _registers;
 	program_counter_t _program_counter;
 	opcode_t _current_opcode;
+	index_register_t _index_register;
+	stack_index_t _stack_pointer;
+	flag_source _flag_source = flag_source::none;
+	register_t _flag_left = 0;
+	register_t _flag_right = 0;
 
 	timer_counter_t _delay_timer;
 	timer_counter_t _sound_timer;
+
+	keypad_t _keypad = 0;
+	bool _waiting_key = false;
+	bool _idle_skip = false;
+	bool _idle = false;
+	bool _hires = false;
+	uint8_t _plane_mask = 0x1;
+
+	// Cold: touched only by particular instructions.
+	alignas(cache_line_size) std::array<stack_t, max_stack> _stack;
+	size_t _waiting_register = 0;
+
+	// Read once per run() call rather than per instruction, and null unless
+	// an AOT plugin is loaded.
+	aot::run_t _translation = nullptr;
+
+	std::array<register_t, num_flags> _flags{};
+
+	pattern_t _pattern{};
+	register_t _pitch = default_pitch;
+	random_t _random = default_seed;
+
+	ram_t _ram;
+	std::array<vram_t, num_planes> _vram;
+	std::array<uint64_t, ram_t::num_pages> _page_hashes{};
+	uint64_t _vram_hash = 0;
+	bool _vram_dirty = true;
+
+	decode_cache _cache;
 };
 
 template<unsigned Width = 64, unsigned Height = 32, typename PixelType = unsigned int>
@@ -352,9 +1935,369 @@ public:
 
 	constexpr pixel_t* framebuffer() { return _framebuffer.data(); }
 
+	using palette_t = std::array<pixel_t, 4>;
+
+	// Composite two bitplanes into the framebuffer in a single branch-free pass;
+	// each pixel selects palette[plane0 | plane1 << 1] through bit masks. The
+	// masks for 8 pixels at a time come from a 256-entry table, so each run
+	// is a few vector ANDs and XORs with SSE2 and a short scalar loop elsewhere.
+	template<typename Plane>
+	void compose(const Plane &plane0, const Plane &plane1, unsigned columns, unsigned rows, const palette_t &palette) {
+		constexpr unsigned word_bits = Plane::word_bits;
+		const unsigned words = columns / word_bits;
+
+		const pixel_t colour0 = palette[0];
+		const pixel_t colour2 = palette[2];
+		const pixel_t toggle01 = palette[0] ^ palette[1];
+		const pixel_t toggle23 = palette[2] ^ palette[3];
+
+		auto *line = _framebuffer.data();
+		for (unsigned y = 0; y < rows; ++y, line += width) {
+			const auto &row0 = plane0.row(y);
+			const auto &row1 = plane1.row(y);
+			for (unsigned word = 0; word < words; ++word) {
+				for (unsigned run = 0; run < word_bits / run_bits; ++run) {
+					const unsigned shift = word_bits - run_bits * (run + 1);
+					compose_run(line + word * word_bits + run * run_bits,
+						mask_runs[(row0[word] >> shift) & 0xFF], mask_runs[(row1[word] >> shift) & 0xFF],
+						colour0, colour2, toggle01, toggle23);
+				}
+			}
+		}
+	}
+
 private:
+	static constexpr unsigned run_bits = 8;
+	using mask_run_t = std::array<pixel_t, run_bits>;
+
+	// For every byte value, its 8 bits as all-zero or all-one pixel masks,
+	// most significant bit first.
+	static constexpr std::array<mask_run_t, 256> make_mask_runs() {
+		std::array<mask_run_t, 256> runs{};
+		for (size_t value = 0; value < runs.size(); ++value) {
+			for (size_t bit = 0; bit < run_bits; ++bit) {
+				runs[value][bit] = ((value >> (run_bits - 1 - bit)) & 1) ? ~pixel_t{0} : pixel_t{0};
+			}
+		}
+		return runs;
+	}
+
+	static constexpr std::array<mask_run_t, 256> mask_runs = make_mask_runs();
+
+	// Writes the 8 pixels one mask run from each plane selects:
+	// low = plane0 ? palette[1] : palette[0], high likewise for palette[2]
+	// and palette[3], then plane1 picks between low and high.
+	static void compose_run(pixel_t *out, const mask_run_t &mask0, const mask_run_t &mask1,
+		pixel_t colour0, pixel_t colour2, pixel_t toggle01, pixel_t toggle23) {
+#if CHIP8_HAS_SSE2
+		if constexpr (sizeof(pixel_t) == sizeof(uint32_t)) {
+			const __m128i base0 = _mm_set1_epi32(static_cast<int>(colour0));
+			const __m128i base2 = _mm_set1_epi32(static_cast<int>(colour2));
+			const __m128i flip01 = _mm_set1_epi32(static_cast<int>(toggle01));
+			const __m128i flip23 = _mm_set1_epi32(static_cast<int>(toggle23));
+			for (unsigned bit = 0; bit < run_bits; bit += 4) {
+				const __m128i select0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask0.data() + bit));
+				const __m128i select1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask1.data() + bit));
+				const __m128i low = _mm_xor_si128(base0, _mm_and_si128(flip01, select0));
+				const __m128i high = _mm_xor_si128(base2, _mm_and_si128(flip23, select0));
+				const __m128i pixels = _mm_xor_si128(low, _mm_and_si128(_mm_xor_si128(low, high), select1));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(out + bit), pixels);
+			}
+			return;
+		}
+#endif
+		for (unsigned bit = 0; bit < run_bits; ++bit) {
+			const pixel_t low = colour0 ^ (toggle01 & mask0[bit]);
+			const pixel_t high = colour2 ^ (toggle23 & mask0[bit]);
+			out[bit] = low ^ ((low ^ high) & mask1[bit]);
+		}
+	}
+
 	framebuffer_t _framebuffer{};
 };
 
-} // namespace chip8
+namespace detail {
+
+constexpr double pi = 3.14159265358979323846;
+
+constexpr double sin(double x) {
+	while (x > pi) x -= 2 * pi;
+	while (x < -pi) x += 2 * pi;
+	double term = x;
+	double sum = x;
+	for (int i = 1; i < 12; ++i) {
+		term *= -x * x / ((2 * i) * (2 * i + 1));
+		sum += term;
+	}
+	return sum;
+}
+
+constexpr double cos(double x) { return sin(x + pi / 2); }
+
+constexpr double exp(double x) {
+	constexpr double ln2 = 0.69314718055994530942;
+	int k = static_cast<int>(x / ln2);
+	const double r = x - k * ln2;
+	double term = 1;
+	double sum = 1;
+	for (int i = 1; i < 20; ++i) {
+		term *= r / i;
+		sum += term;
+	}
+	for (; k > 0; --k) sum *= 2;
+	for (; k < 0; ++k) sum /= 2;
+	return sum;
+}
+
+constexpr double log(double x) {
+	constexpr double ln2 = 0.69314718055994530942;
+	int k = 0;
+	for (; x >= 2; x /= 2) ++k;
+	for (; x < 1; x *= 2) --k;
+	const double z = (x - 1) / (x + 1);
+	double term = z;
+	double sum = 0;
+	for (int i = 1; i < 40; i += 2) {
+		sum += term / i;
+		term *= z * z;
+	}
+	return 2 * sum + k * ln2;
+}
 
+struct complex {
+	double re = 0;
+	double im = 0;
+};
+
+template<size_t N>
+constexpr void fft(std::array<complex, N> &data, bool inverse) {
+	for (size_t i = 1, j = 0; i < N; ++i) {
+		size_t bit = N >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			const auto t = data[i];
+			data[i] = data[j];
+			data[j] = t;
+		}
+	}
+	for (size_t length = 2; length <= N; length <<= 1) {
+		const double angle = (inverse ? 2 : -2) * pi / length;
+		const complex root{ cos(angle), sin(angle) };
+		for (size_t i = 0; i < N; i += length) {
+			complex w{ 1, 0 };
+			for (size_t j = 0; j < length / 2; ++j) {
+				const auto u = data[i + j];
+				const auto &o = data[i + j + length / 2];
+				const complex v{ o.re * w.re - o.im * w.im, o.re * w.im + o.im * w.re };
+				data[i + j] = { u.re + v.re, u.im + v.im };
+				data[i + j + length / 2] = { u.re - v.re, u.im - v.im };
+				w = { w.re * root.re - w.im * root.im, w.re * root.im + w.im * root.re };
+			}
+		}
+	}
+	if (inverse) {
+		for (auto &c : data) {
+			c.re /= N;
+			c.im /= N;
+		}
+	}
+}
+
+// Minimum-phase band-limited step (Brandt), integrated and normalised to rise from 0 to 1.
+template<size_t ZeroCrossings, size_t Oversampling>
+constexpr auto make_minblep() {
+	constexpr size_t length = ZeroCrossings * 2 * Oversampling;
+	constexpr size_t fft_size = length * 2;
+
+	std::array<complex, fft_size> buffer{};
+	for (size_t i = 0; i < length; ++i) {
+		const double t = (static_cast<double>(i) - length / 2.0) / Oversampling;
+		const double sinc = (t == 0) ? 1.0 : sin(pi * t) / (pi * t);
+		const double phase = 2 * pi * i / (length - 1);
+		const double window = 0.42 - 0.5 * cos(phase) + 0.08 * cos(2 * phase);
+		buffer[i].re = sinc * window;
+	}
+
+	// Real cepstrum, folded to make it causal, then back to the time domain.
+	fft(buffer, false);
+	for (auto &c : buffer) {
+		const double power = c.re * c.re + c.im * c.im;
+		c = { 0.5 * log(power > 1e-40 ? power : 1e-40), 0 };
+	}
+	fft(buffer, true);
+	for (size_t i = 1; i < fft_size / 2; ++i) {
+		buffer[i].re *= 2;
+		buffer[i].im *= 2;
+	}
+	for (size_t i = fft_size / 2 + 1; i < fft_size; ++i) buffer[i] = {};
+	fft(buffer, false);
+	for (auto &c : buffer) {
+		const double magnitude = exp(c.re);
+		c = { magnitude * cos(c.im), magnitude * sin(c.im) };
+	}
+	fft(buffer, true);
+
+	std::array<float, length + 1> table{};
+	double sum = 0;
+	for (size_t i = 0; i < length; ++i) {
+		sum += buffer[i].re;
+		table[i] = static_cast<float>(sum);
+	}
+	for (size_t i = 0; i < length; ++i) table[i] = static_cast<float>(table[i] / sum);
+	table[length] = 1.0f;
+	return table;
+}
+
+} // namespace detail
+
+template<size_t ZeroCrossings = 8, size_t Oversampling = 16>
+struct minblep {
+	static constexpr size_t zero_crossings = ZeroCrossings;
+	static constexpr size_t oversampling = Oversampling;
+	static constexpr size_t length = zero_crossings * 2 * oversampling;
+	static constexpr size_t span = length / oversampling;
+	static constexpr auto table = detail::make_minblep<zero_crossings, oversampling>();
+
+	// Step response `offset` output samples after the discontinuity.
+	static constexpr float step(float offset) {
+		const float position = offset * oversampling;
+		const auto index = static_cast<size_t>(position);
+		if (index >= length) return 1.0f;
+		const float fraction = position - static_cast<float>(index);
+		return table[index] + (table[index + 1] - table[index]) * fraction;
+	}
+};
+
+template<unsigned SampleRate = 48000, unsigned Fps = 60, typename SampleType = int16_t>
+class audio {
+public:
+	static constexpr unsigned sample_rate = SampleRate;
+	static constexpr unsigned fps = Fps;
+	static constexpr size_t num_channels = 2;
+	static constexpr size_t samples_per_frame = sample_rate / fps;
+	static constexpr size_t max_samples_per_frame = samples_per_frame * 2;
+
+	using sample_t = SampleType;
+	using phase_t = uint32_t;
+	using buffer_t = std::array<sample_t, max_samples_per_frame * num_channels>;
+
+	static constexpr sample_t amplitude = std::numeric_limits<sample_t>::max() / 4;
+	static constexpr unsigned phase_fraction_bits = 16;
+	static constexpr phase_t phase_one = phase_t{1} << phase_fraction_bits;
+
+	using blep_t = minblep<>;
+
+	enum class quality {
+		naive,
+		band_limited,
+	};
+
+	// XO-CHIP plays the 128-bit pattern at 4000 * 2^((pitch - 64) / 48) bits per second.
+	static double playback_rate(uint8_t pitch) {
+		return 4000.0 * std::pow(2.0, (static_cast<double>(pitch) - 64.0) / 48.0);
+	}
+
+	constexpr const sample_t* data() const { return _buffer.data(); }
+
+	constexpr void set_quality(quality value) { _quality = value; }
+
+	// Silences the synthesiser as if it had just been created, keeping the quality.
+	constexpr void reset() {
+		_phase = 0;
+		_level = 0;
+		_residual.fill(0.0f);
+		_head = 0;
+		_buffer.fill(0);
+	}
+
+	template<typename Pattern>
+	size_t render(bool active, const Pattern &pattern, uint8_t pitch, size_t count = samples_per_frame) {
+		if (count > max_samples_per_frame) count = max_samples_per_frame;
+
+		switch (_quality) {
+		case quality::naive: return render_naive(active, pattern, pitch, count);
+		case quality::band_limited: return render_band_limited(active, pattern, pitch, count);
+		}
+		return 0;
+	}
+
+private:
+	template<typename Pattern>
+	static constexpr int pattern_level(const Pattern &pattern, phase_t bit) {
+		return ((pattern[bit >> 3] >> (7 - (bit & 7))) & 1) ? amplitude : -amplitude;
+	}
+
+	template<typename Pattern>
+	size_t render_naive(bool active, const Pattern &pattern, uint8_t pitch, size_t count) {
+		if (!active) {
+			_buffer.fill(0);
+			return count;
+		}
+
+		constexpr phase_t pattern_bits = std::tuple_size<Pattern>::value * 8;
+		constexpr phase_t phase_mask = (pattern_bits << phase_fraction_bits) - 1;
+		const auto step = static_cast<phase_t>(playback_rate(pitch) / sample_rate * phase_one);
+
+		for (size_t i = 0; i < count; ++i) {
+			const auto sample = static_cast<sample_t>(pattern_level(pattern, _phase >> phase_fraction_bits));
+			for (size_t channel = 0; channel < num_channels; ++channel) {
+				_buffer[i * num_channels + channel] = sample;
+			}
+			_phase = (_phase + step) & phase_mask;
+		}
+		return count;
+	}
+
+	// Each pattern edge adds a minBLEP residual at its sub-sample position,
+	// so only edges cost work and the square wave stays free of aliasing.
+	template<typename Pattern>
+	size_t render_band_limited(bool active, const Pattern &pattern, uint8_t pitch, size_t count) {
+		constexpr phase_t pattern_bits = std::tuple_size<Pattern>::value * 8;
+		constexpr phase_t phase_mask = (pattern_bits << phase_fraction_bits) - 1;
+		const auto step = static_cast<phase_t>(playback_rate(pitch) / sample_rate * phase_one);
+
+		const int start = active ? pattern_level(pattern, _phase >> phase_fraction_bits) : 0;
+		if (start != _level) add_step(start - _level, 0.0f);
+		_level = start;
+
+		for (size_t i = 0; i < count; ++i) {
+			if (active && step > 0) {
+				const phase_t next = _phase + step;
+				for (phase_t edge = (_phase | (phase_one - 1)) + 1; edge <= next; edge += phase_one) {
+					const int level = pattern_level(pattern, (edge >> phase_fraction_bits) & (pattern_bits - 1));
+					if (level != _level) {
+						add_step(level - _level, static_cast<float>(next - edge) / static_cast<float>(step));
+						_level = level;
+					}
+				}
+				_phase = next & phase_mask;
+			}
+
+			const auto sample = static_cast<sample_t>(static_cast<float>(_level) + _residual[_head]);
+			_residual[_head] = 0.0f;
+			_head = (_head + 1) % blep_t::span;
+
+			for (size_t channel = 0; channel < num_channels; ++channel) {
+				_buffer[i * num_channels + channel] = sample;
+			}
+		}
+		return count;
+	}
+
+	constexpr void add_step(int delta, float offset) {
+		for (size_t i = 0; i < blep_t::span; ++i) {
+			const float residual = blep_t::step(static_cast<float>(i) + offset) - 1.0f;
+			_residual[(_head + i) % blep_t::span] += static_cast<float>(delta) * residual;
+		}
+	}
+
+	quality _quality = quality::band_limited;
+	phase_t _phase = 0;
+	int _level = 0;
+	std::array<float, blep_t::span> _residual{};
+	size_t _head = 0;
+	buffer_t _buffer{};
+};
+
+} // namespace chip8
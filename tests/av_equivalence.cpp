@@ -0,0 +1,141 @@
+// Runs the same ROM once with audio and video enabled and once with both
+// disabled, as a run-ahead or netplay replay instance would, and checks
+// that the two end in the same serialized state and that the next frame's
+// audio is identical. Also checks that a state with a damaged header is
+// refused.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "libretro.h"
+
+namespace {
+
+// Draws random sprites, drives both timers from a counter and stores its
+// BCD with Fx33, so video, audio and RAM all change every iteration.
+const uint8_t rom[] = {
+    0xA2, 0x30, // 200: I = 230
+    0xC0, 0x3F, // 202: V0 = rand & 3F
+    0xC1, 0x1F, // 204: V1 = rand & 1F
+    0xD0, 0x15, // 206: draw 5 rows at V0, V1
+    0x73, 0x01, // 208: V3 += 1
+    0xF3, 0x15, // 20A: delay = V3
+    0xF3, 0x18, // 20C: sound = V3
+    0xA3, 0x00, // 20E: I = 300
+    0xF3, 0x33, // 210: BCD of V3 at I
+    0x12, 0x00, // 212: jump 200
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 230: sprite
+};
+
+constexpr int frames = 300;
+
+int av_enable = 0x3;
+
+bool environment(unsigned cmd, void* data)
+{
+    switch (cmd)
+    {
+    case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+        return true;
+    case RETRO_ENVIRONMENT_GET_CAN_DUPE:
+        *static_cast<bool*>(data) = true;
+        return true;
+    case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+        *static_cast<int*>(data) = av_enable;
+        return true;
+    default:
+        return false;
+    }
+}
+
+void video_refresh(const void*, unsigned, unsigned, size_t) {}
+void audio_sample(int16_t, int16_t) {}
+std::vector<int16_t> last_batch;
+
+size_t audio_sample_batch(const int16_t* data, size_t frames)
+{
+    last_batch.assign(data, data + frames * 2);
+    return frames;
+}
+
+void input_poll() {}
+int16_t input_state(unsigned, unsigned, unsigned, unsigned) { return 0; }
+
+struct result {
+    std::vector<uint8_t> state;
+    std::vector<int16_t> audio;
+};
+
+// Runs `frames` frames with `enable`, then one more with everything enabled
+// to capture the audio that follows.
+result run(int enable)
+{
+    retro_game_info info{ "test.ch8", rom, sizeof(rom), nullptr };
+    retro_load_game(&info);
+    av_enable = enable;
+    for (int i = 0; i < frames; ++i)
+        retro_run();
+
+    av_enable = 0x3;
+    last_batch.clear();
+    retro_run();
+
+    result out;
+    out.audio = last_batch;
+    out.state.resize(retro_serialize_size());
+    retro_serialize(out.state.data(), out.state.size());
+    retro_unload_game();
+    return out;
+}
+
+} // namespace
+
+int main()
+{
+    retro_set_environment(environment);
+    retro_set_video_refresh(video_refresh);
+    retro_set_audio_sample(audio_sample);
+    retro_set_audio_sample_batch(audio_sample_batch);
+    retro_set_input_poll(input_poll);
+    retro_set_input_state(input_state);
+    retro_init();
+
+    const auto presented = run(0x3);
+    const auto discarded = run(0x0);
+
+    int failures = 0;
+    if (presented.state != discarded.state)
+    {
+        fprintf(stderr, "state differs after %d frames with audio and video disabled\n", frames);
+        ++failures;
+    }
+    if (presented.audio.empty() || presented.audio != discarded.audio)
+    {
+        fprintf(stderr, "audio differs after %d frames with audio and video disabled\n", frames);
+        ++failures;
+    }
+
+    retro_game_info info{ "test.ch8", rom, sizeof(rom), nullptr };
+    retro_load_game(&info);
+    if (!retro_unserialize(presented.state.data(), presented.state.size()))
+    {
+        fprintf(stderr, "a valid state was refused\n");
+        ++failures;
+    }
+
+    auto damaged = presented.state;
+    damaged[0] ^= 0xFE;
+    if (retro_unserialize(damaged.data(), damaged.size()))
+    {
+        fprintf(stderr, "a state with a damaged header was accepted\n");
+        ++failures;
+    }
+    retro_unload_game();
+
+    retro_deinit();
+    return failures ? 1 : 0;
+}
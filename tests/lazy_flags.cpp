@@ -0,0 +1,127 @@
+// Checks that VF, which the arithmetic instructions only work out when it
+// is next read, holds the right value wherever it is read: as an operand of
+// 8xy4/5/6/7/E with either X or Y = F, by the skips, Fx33, Fx55 and Bnnn,
+// and in a serialized state taken while a flag is still pending.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "program.hpp"
+
+namespace {
+
+using test::program;
+using test::run_everywhere;
+
+constexpr uint16_t scratch = 0xD00;
+
+int arithmetic()
+{
+    int failures = 0;
+
+    // X = F: the flag replaces the result.
+    failures += run_everywhere("8F14", program().op(0x6FFF).op(0x6101).op(0x8F14).expect(0xF, 1).pass());
+    failures += run_everywhere("8F15", program().op(0x6F05).op(0x6106).op(0x8F15).expect(0xF, 0).pass());
+    failures += run_everywhere("8F16", program().op(0x6102).op(0x6F07).op(0x8F16).expect(0xF, 0).pass());
+    failures += run_everywhere("8F17", program().op(0x6F05).op(0x6103).op(0x8F17).expect(0xF, 0).pass());
+    failures += run_everywhere("8F1E", program().op(0x6181).op(0x8F1E).expect(0xF, 1).pass());
+
+    // Y = F: the operand is VF as it was before the instruction.
+    failures += run_everywhere("80F4", program().op(0x6F02).op(0x60FF).op(0x80F4).expect(0x0, 1).expect(0xF, 1).pass());
+    failures += run_everywhere("80F5", program().op(0x6F03).op(0x6005).op(0x80F5).expect(0x0, 2).expect(0xF, 1).pass());
+    failures += run_everywhere("80F6", program().op(0x6F05).op(0x80F6).expect(0x0, 2).expect(0xF, 1).pass());
+    failures += run_everywhere("80F7", program().op(0x6F07).op(0x6002).op(0x80F7).expect(0x0, 5).expect(0xF, 1).pass());
+    failures += run_everywhere("80FE", program().op(0x6F40).op(0x80FE).expect(0x0, 0x80).expect(0xF, 0).pass());
+
+    // Y = F while the previous flag is still pending.
+    failures += run_everywhere("pending 82F4",
+        program().op(0x60FF).op(0x6101).op(0x8014).op(0x6203).op(0x82F4).expect(0x2, 4).expect(0xF, 0).pass());
+    failures += run_everywhere("pending 8F14 8F14",
+        program().op(0x60FF).op(0x6101).op(0x8014).op(0x8F14).expect(0xF, 0).pass());
+
+    return failures;
+}
+
+int readers()
+{
+    int failures = 0;
+
+    // Each program sets VF to 7 first, so a stale read is told apart from
+    // the carry of 1 that 8014 leaves pending.
+    failures += run_everywhere("5xy0",
+        program().op(0x6F07).op(0x60FF).op(0x6101).op(0x8014).op(0x6201).op(0x52F0).fail().pass());
+    failures += run_everywhere("9xy0",
+        program().op(0x6F07).op(0x60FF).op(0x6101).op(0x8014).op(0x6201).op(0x92F0).pass().fail());
+    failures += run_everywhere("Fx33",
+        program().op(0x6F07).op(0x60C8).op(0x6164).op(0x8014)
+            .op(0xA000 | scratch).op(0xFF33).op(0xA000 | scratch).op(0xF265)
+            .expect(0x0, 0).expect(0x1, 0).expect(0x2, 1).pass());
+    failures += run_everywhere("Fx55",
+        program().op(0x6F07).op(0x60FF).op(0x6102).op(0x8014)
+            .op(0xA000 | scratch).op(0xFF55).op(0xA00F | scratch).op(0xF065)
+            .expect(0x0, 1).pass());
+
+    // SCHIP's Bxnn jumps to xnn + Vx, so BF00 lands on F01 with the carry
+    // and on F04 with the stale sum.
+    program jump;
+    jump.op(0x6FFF).op(0x6105).op(0x8F14).op(0xBF00);
+    jump.at(0xF01).pass();
+    jump.at(0xF04).fail();
+    failures += run_everywhere<chip8::quirks::schip>("Bxnn", jump);
+
+    return failures;
+}
+
+// Stops with the carry of 8F14 still pending, saves, and checks that the
+// restored machine sees it.
+int serialized()
+{
+    program code;
+    code.op(0x6FFF).op(0x6101).op(0x8F14).expect(0xF, 1).pass();
+
+    int failures = 0;
+    for (const auto& engine : test::engines)
+    {
+        chip8::cpu<chip8::quirks::cosmac_vip> cpu;
+        cpu.load(code.rom().data(), code.rom().size());
+        cpu.run(3, engine.mode);
+        if (cpu.program_counter() != 0x206)
+        {
+            fprintf(stderr, "serialize (%s): ran to %03X instead of 206\n", engine.name,
+                static_cast<unsigned>(cpu.program_counter()));
+            ++failures;
+            continue;
+        }
+
+        std::vector<uint8_t> state(sizeof(cpu));
+        cpu.serialize(state.data());
+
+        chip8::cpu<chip8::quirks::cosmac_vip> restored;
+        restored.load(code.rom().data(), code.rom().size());
+        if (!restored.unserialize(state.data()))
+        {
+            fprintf(stderr, "serialize (%s): state was refused\n", engine.name);
+            ++failures;
+            continue;
+        }
+
+        restored.run(100, engine.mode);
+        if (restored.program_counter() != test::pass_address)
+        {
+            fprintf(stderr, "serialize (%s): stopped at %03X\n", engine.name,
+                static_cast<unsigned>(restored.program_counter()));
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+} // namespace
+
+int main()
+{
+    const int failures = arithmetic() + readers() + serialized();
+    return failures ? 1 : 0;
+}
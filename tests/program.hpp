@@ -0,0 +1,104 @@
+#pragma once
+
+// Self-checking CHIP-8 programs for the engine tests. A program ends in a
+// jump-to-self at pass_address when every check holds, and at fail_address
+// as soon as one does not, so a test only has to look at the final PC.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "chip8.hpp"
+
+namespace test {
+
+// Zeroed RAM executes as no-ops, so the fail loop comes first: a program
+// that runs off the end of its code reaches it before the pass loop.
+constexpr uint16_t fail_address = 0xE00;
+constexpr uint16_t pass_address = 0xE02;
+
+// Assembles opcodes at chosen addresses into a ROM loaded at 0x200.
+class program {
+public:
+    program() { at(fail_address).fail().pass(); at(0x200); }
+
+    program& at(size_t address) {
+        _address = address;
+        return *this;
+    }
+
+    program& op(uint16_t opcode) {
+        byte(static_cast<uint8_t>(opcode >> 8));
+        return byte(static_cast<uint8_t>(opcode));
+    }
+
+    program& byte(uint8_t value) {
+        const size_t offset = _address++ - 0x200;
+        if (_rom.size() <= offset)
+            _rom.resize(offset + 1);
+        _rom[offset] = value;
+        return *this;
+    }
+
+    // Falls through when Vx == kk and fails otherwise.
+    program& expect(unsigned x, uint8_t kk) { return op(0x3000 | (x << 8) | kk).fail(); }
+
+    program& fail() { return op(0x1000 | fail_address); }
+    program& pass() { return op(0x1000 | pass_address); }
+
+    const std::vector<uint8_t>& rom() const { return _rom; }
+
+private:
+    std::vector<uint8_t> _rom;
+    size_t _address = 0x200;
+};
+
+struct engine_info {
+    const char* name;
+    chip8::engine mode;
+};
+
+constexpr engine_info engines[] = {
+    { "switch", chip8::engine::switch_case },
+    { "table", chip8::engine::table },
+    { "threaded", chip8::engine::threaded },
+    { "cached", chip8::engine::cached },
+};
+
+// Slice lengths for run(). A fused entry that does not fit in what is left
+// of a slice runs one instruction at a time, so a single length can hide a
+// stale entry behind a slice boundary.
+constexpr size_t slices[] = { 3, 10, 100 };
+
+// Runs `code` for a few thousand instructions on every engine and slice
+// length and reports each run that does not end at pass_address. Returns
+// the failure count.
+template<typename Quirks = chip8::quirks::cosmac_vip>
+int run_everywhere(const char* name, const program& code, size_t cycles = 4000)
+{
+    int failures = 0;
+    for (const auto& engine : engines)
+    {
+        for (const size_t slice : slices)
+        {
+            chip8::cpu<Quirks> cpu;
+            cpu.load(code.rom().data(), code.rom().size());
+            for (size_t done = 0; done < cycles; done += slice)
+            {
+                cpu.run(slice, engine.mode);
+                cpu.update_timers();
+            }
+
+            if (cpu.program_counter() != pass_address)
+            {
+                fprintf(stderr, "%s (%s, %s, %zu per run): stopped at %03X\n", name, Quirks::name, engine.name,
+                    slice, static_cast<unsigned>(cpu.program_counter()));
+                ++failures;
+            }
+        }
+    }
+    return failures;
+}
+
+} // namespace test
@@ -0,0 +1,72 @@
+// Checks that masked memory wraps at the top of RAM on every engine: Fx55
+// and Fx65 running past FFF, and a fetch at FFE falling through to 000,
+// including after 000 has been rewritten since FFE was last run.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "program.hpp"
+
+namespace {
+
+using test::program;
+using test::run_everywhere;
+
+int load_store()
+{
+    program code;
+    code.op(0xAFFF)             // 200: I = FFF
+        .op(0x60AB)             // 202: V0 = AB
+        .op(0x61CD)             // 204: V1 = CD
+        .op(0xF155)             // 206: store V0 at FFF, V1 at 000
+        .op(0xA000)             // 208: I = 000
+        .op(0xF065)             // 20A: load V0
+        .expect(0x0, 0xCD)      // 20C
+        .op(0xAFFF)             // 210: I = FFF
+        .op(0xF165)             // 212: load V0 from FFF, V1 from 000
+        .expect(0x0, 0xAB)      // 214
+        .expect(0x1, 0xCD)      // 218
+        .pass();
+    return run_everywhere("Fx55/Fx65", code);
+}
+
+// FFE and 000 together hold 6400 6301, which the predecoded engine fuses
+// into one entry. They run twice; before the second time 000 is rewritten
+// to 6302, so an entry that still holds the old pair leaves V3 at 1.
+int fetch()
+{
+    program code;
+    code.op(0xA000)             // 200: I = 000
+        .op(0x6063)             // 202: V0 = 63
+        .op(0x6101)             // 204: V1 = 01
+        .op(0x6212)             // 206: V2 = 12
+        .op(0x6310)             // 208: V3 = 10
+        .op(0xF355)             // 20A: store 6301 1210 at 000
+        .op(0x1FFE);            // 20C: jump FFE
+    code.at(0x210)
+        .expect(0x3, 1)         // 210
+        .expect(0x4, 0)         // 214
+        .op(0xA000)             // 218: I = 000
+        .op(0x6063)             // 21A: V0 = 63
+        .op(0x6102)             // 21C: V1 = 02
+        .op(0x6212)             // 21E: V2 = 12
+        .op(0x6330)             // 220: V3 = 30
+        .op(0xF355)             // 222: store 6302 1230 at 000
+        .op(0x1FFE);            // 224: jump FFE
+    code.at(0x230)
+        .expect(0x3, 2)         // 230
+        .pass();
+    code.at(0xFFE)
+        .op(0x6400);            // FFE: V4 = 0, then on to 000
+    return run_everywhere("fetch", code);
+}
+
+} // namespace
+
+int main()
+{
+    const int failures = load_store() + fetch();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+// Checks the predecoded engine's call and return links against the other
+// engines: a subroutine reached from two call sites, one that rewrites the
+// instruction it returns to, and one that rewrites the call that reached it.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "program.hpp"
+
+namespace {
+
+using test::program;
+using test::run_everywhere;
+
+// The same 00EE has to return to whichever call reached it.
+int two_callers()
+{
+    program code;
+    code.op(0x6300)             // 200: V3 = 0
+        .op(0x2300)             // 202: call 300
+        .expect(0x3, 1)         // 204
+        .op(0x2300)             // 208: call 300
+        .expect(0x3, 2)         // 20A
+        .pass();
+    code.at(0x300)
+        .op(0x7301)             // 300: V3 += 1
+        .op(0x00EE);            // 302: return
+    return run_everywhere("two callers", code);
+}
+
+// The second call overwrites the instruction after the call site with a
+// jump to pass_address (1E02) before returning to it.
+int patched_return_site()
+{
+    program code;
+    code.op(0x6300)             // 200: V3 = 0
+        .op(0x2300)             // 202: call 300
+        .op(0x7301)             // 204: V3 += 1, patched to 1E02
+        .op(0x1202);            // 206: jump 202
+    code.at(0x300)
+        .op(0x3301)             // 300: skip if V3 == 1
+        .op(0x00EE)             // 302: return
+        .op(0xA204)             // 304: I = 204
+        .op(0x601E)             // 306: V0 = 1E
+        .op(0x6102)             // 308: V1 = 02
+        .op(0xF155)             // 30A: store V0, V1 at 204
+        .op(0x00EE);            // 30C: return
+    return run_everywhere("patched return site", code);
+}
+
+// The second call overwrites the call at 202 so that the third one goes to
+// 320 instead of 300.
+int patched_call()
+{
+    program code;
+    code.op(0x6300)             // 200: V3 = 0
+        .op(0x2300)             // 202: call 300, patched to call 320
+        .op(0x1202);            // 204: jump 202
+    code.at(0x300)
+        .op(0x7301)             // 300: V3 += 1
+        .op(0x3302)             // 302: skip if V3 == 2
+        .op(0x00EE)             // 304: return
+        .op(0xA202)             // 306: I = 202
+        .op(0x6023)             // 308: V0 = 23
+        .op(0x6120)             // 30A: V1 = 20
+        .op(0xF155)             // 30C: store V0, V1 at 202
+        .op(0x00EE);            // 30E: return
+    code.at(0x320)
+        .expect(0x3, 2)         // 320
+        .pass();
+    return run_everywhere("patched call", code);
+}
+
+// Recurses until the stack is full. The seventeenth call does nothing, so
+// execution carries on after it rather than at its target.
+int overflow()
+{
+    program code;
+    code.op(0x6300)             // 200: V3 = 0
+        .op(0x2300);            // 202: call 300
+    code.at(0x300)
+        .op(0x7301)             // 300: V3 += 1
+        .op(0x2300)             // 302: call 300
+        .expect(0x3, 16)        // 304
+        .pass();
+    return run_everywhere("overflow", code);
+}
+
+} // namespace
+
+int main()
+{
+    const int failures = two_callers() + patched_return_site() + patched_call() + overflow();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,277 @@
+// Ahead-of-time recompiler: turns a ROM into a C++ translation unit that
+// builds into a plugin the core picks up by ROM hash.
+//
+//   chip8_recompile <rom> <output.cpp> [cosmac_vip|schip|xo_chip]
+//
+// Compile the output as a shared library against include/chip8.hpp (or use
+// chip8_add_aot_plugin() from CMake) and install it as
+// <system directory>/chip8_aot/<hash>.so, where <hash> is printed below.
+//
+// Control flow is recovered from the program entry point by following
+// fall-through, skips, 1nnn and 2nnn (plus its return address). Bnnn marks
+// every even address in its 256-byte reach as an entry point. 00EE, Bnnn
+// and taken branches into unrecovered code return to the interpreter
+// through the PC switch. Every instruction re-checks its opcode in RAM
+// first, so self-modified code also falls back to the interpreter.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "chip8.hpp"
+
+namespace {
+
+constexpr size_t program_address = 0x200;
+
+enum class flow {
+    next,
+    skip,
+    jump,
+    call,
+    dynamic,
+};
+
+struct variant_info {
+    const char* name;
+    bool xo_instructions;
+};
+
+// Indexed by chip8::variant.
+constexpr variant_info variants[] = {
+    { chip8::quirks::cosmac_vip::name, chip8::quirks::cosmac_vip::xo_instructions },
+    { chip8::quirks::schip::name, chip8::quirks::schip::xo_instructions },
+    { chip8::quirks::xo_chip::name, chip8::quirks::xo_chip::xo_instructions },
+};
+
+class recompiler {
+public:
+    recompiler(std::vector<uint8_t> rom, const variant_info& variant)
+        : _rom(std::move(rom)), _variant(variant) {}
+
+    void recover() {
+        std::vector<size_t> pending{ program_address };
+        while (!pending.empty()) {
+            const size_t address = pending.back();
+            pending.pop_back();
+            if (!contains(address) || !_code.insert(address).second)
+                continue;
+
+            const auto opcode = fetch(address);
+            const size_t next = address + length(opcode);
+            switch (flow_of(opcode)) {
+            case flow::next:
+                pending.push_back(next);
+                break;
+            case flow::skip:
+                pending.push_back(next);
+                pending.push_back(next + 2);
+                if (_variant.xo_instructions)
+                    pending.push_back(next + 4);
+                break;
+            case flow::jump:
+                pending.push_back(opcode & 0x0FFF);
+                break;
+            case flow::call:
+                pending.push_back(opcode & 0x0FFF);
+                pending.push_back(next);
+                break;
+            case flow::dynamic:
+                if ((opcode & 0xF000) == 0xB000) {
+                    for (size_t offset = 0; offset <= 0xFF; offset += 2)
+                        pending.push_back((opcode & 0x0FFF) + offset);
+                }
+                break;
+            }
+        }
+    }
+
+    void emit(FILE* out, const char* source, uint64_t hash) const {
+        fprintf(out, "// Generated by chip8_recompile from %s. Do not edit.\n\n", source);
+        fprintf(out, "#include \"chip8.hpp\"\n\n");
+        fprintf(out, "namespace {\n\n");
+        fprintf(out, "using cpu_t = chip8::cpu<chip8::quirks::%s>;\n\n", _variant.name);
+        fprintf(out, "size_t run(void* state, size_t cycles)\n{\n");
+        fprintf(out, "    auto& c = *static_cast<cpu_t*>(state);\n");
+        fprintf(out, "    size_t executed = 0;\n\n");
+        fprintf(out, "dispatch:\n");
+        fprintf(out, "    switch (c.program_counter()) {\n");
+        for (const auto address : _code)
+            fprintf(out, "    case 0x%03zX: goto L_%03zX;\n", address, address);
+        fprintf(out, "    default: return executed;\n");
+        fprintf(out, "    }\n");
+
+        for (const auto address : _code) {
+            const auto opcode = fetch(address);
+            const size_t next = address + length(opcode);
+
+            fprintf(out, "\nL_%03zX:\n", address);
+            fprintf(out, "    if (executed == cycles || c.stopped() || c.fetch(0x%03zX) != 0x%04X)\n", address, opcode);
+            fprintf(out, "        return executed;\n");
+            fprintf(out, "    c.enter(0x%03zX, 0x%04X);\n", address, opcode);
+            fprintf(out, "    c.%s;\n", handler(opcode).c_str());
+            fprintf(out, "    ++executed;\n");
+
+            switch (flow_of(opcode)) {
+            case flow::next: {
+                const auto following = _code.upper_bound(address);
+                if (following == _code.end() || *following != next)
+                    emit_goto(out, next);
+                break;
+            }
+            case flow::jump:
+                emit_goto(out, opcode & 0x0FFF);
+                break;
+            case flow::skip:
+            case flow::call: {
+                const size_t target = (flow_of(opcode) == flow::call) ? (opcode & 0x0FFF) : next;
+                if (_code.count(target))
+                    fprintf(out, "    if (c.program_counter() == 0x%03zX) goto L_%03zX;\n", target, target);
+                fprintf(out, "    goto dispatch;\n");
+                break;
+            }
+            case flow::dynamic:
+                fprintf(out, "    goto dispatch;\n");
+                break;
+            }
+        }
+
+        fprintf(out, "}\n\n");
+        fprintf(out, "} // namespace\n\n");
+        fprintf(out, "CHIP8_AOT_EXPORT const chip8::aot::plugin* chip8_aot_plugin()\n{\n");
+        fprintf(out, "    static const chip8::aot::plugin plugin{\n");
+        fprintf(out, "        chip8::aot::abi_version, 0x%016llXULL, cpu_t::quirks_t::name, sizeof(cpu_t),\n"
+                "        cpu_t::layout_fingerprint(), run,\n",
+                static_cast<unsigned long long>(hash));
+        fprintf(out, "    };\n");
+        fprintf(out, "    return &plugin;\n");
+        fprintf(out, "}\n");
+    }
+
+    size_t instructions() const { return _code.size(); }
+
+private:
+    bool contains(size_t address) const {
+        return address >= program_address && address + 1 < program_address + _rom.size();
+    }
+
+    uint16_t fetch(size_t address) const {
+        const size_t offset = address - program_address;
+        return static_cast<uint16_t>((_rom[offset] << 8) | _rom[offset + 1]);
+    }
+
+    size_t length(uint16_t opcode) const {
+        return (_variant.xo_instructions && opcode == 0xF000) ? 4 : 2;
+    }
+
+    static flow flow_of(uint16_t opcode) {
+        switch (opcode & 0xF000) {
+        case 0x0000: return (opcode == 0x00EE || opcode == 0x00FD) ? flow::dynamic : flow::next;
+        case 0x1000: return flow::jump;
+        case 0x2000: return flow::call;
+        case 0x3000:
+        case 0x4000:
+        case 0x9000:
+        case 0xE000: return flow::skip;
+        case 0x5000: return ((opcode & 0x000F) == 0x0) ? flow::skip : flow::next;
+        case 0xB000: return flow::dynamic;
+        default: return flow::next;
+        }
+    }
+
+    // The handler the switch engine would call, with register operands
+    // baked in where the cpu offers specialised handlers.
+    static std::string handler(uint16_t opcode) {
+        static const char* const by_group[16] = {
+            "op_0nnn()", "op_1nnn()", "op_2nnn()", "op_3xkk()",
+            "op_4xkk()", "dispatch_5()", "op_6xkk()", "op_7xkk()",
+            nullptr, nullptr, "op_Annn()", "op_Bnnn()",
+            "op_Cxkk()", "op_Dxyn()", "dispatch_E()", "dispatch_F()",
+        };
+
+        const unsigned x = (opcode >> 8) & 0xF;
+        const unsigned y = (opcode >> 4) & 0xF;
+        const unsigned n = opcode & 0xF;
+        char buffer[32];
+
+        switch (opcode & 0xF000) {
+        case 0x5000:
+            if (n != 0x0)
+                break;
+            snprintf(buffer, sizeof(buffer), "op_5xy0<%u, %u>()", x, y);
+            return buffer;
+        case 0x8000:
+            if (n > 0x7 && n != 0xE)
+                return "op_error()";
+            snprintf(buffer, sizeof(buffer), "op_8xy%X<%u, %u>()", n, x, y);
+            return buffer;
+        case 0x9000:
+            snprintf(buffer, sizeof(buffer), "op_9xy0<%u, %u>()", x, y);
+            return buffer;
+        }
+        return by_group[opcode >> 12];
+    }
+
+    void emit_goto(FILE* out, size_t target) const {
+        if (_code.count(target))
+            fprintf(out, "    goto L_%03zX;\n", target);
+        else
+            fprintf(out, "    goto dispatch;\n");
+    }
+
+    std::vector<uint8_t> _rom;
+    variant_info _variant;
+    std::set<size_t> _code;
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <rom> <output.cpp> [cosmac_vip|schip|xo_chip]\n", argv[0]);
+        return 1;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    const variant_info* variant = &variants[static_cast<size_t>(chip8::variant_from_path(argv[1]))];
+    if (argc > 3) {
+        variant = nullptr;
+        for (const auto& candidate : variants) {
+            if (strcmp(argv[3], candidate.name) == 0)
+                variant = &candidate;
+        }
+        if (!variant) {
+            fprintf(stderr, "unknown variant %s\n", argv[3]);
+            return 1;
+        }
+    }
+
+    const uint64_t hash = chip8::detail::xxh64(rom.data(), rom.size());
+
+    recompiler compiler(std::move(rom), *variant);
+    compiler.recover();
+
+    FILE* out = fopen(argv[2], "w");
+    if (!out) {
+        fprintf(stderr, "cannot write %s\n", argv[2]);
+        return 1;
+    }
+    compiler.emit(out, argv[1], hash);
+    fclose(out);
+
+    printf("%016llx %zu instructions (%s)\n", static_cast<unsigned long long>(hash), compiler.instructions(), variant->name);
+    return 0;
+}